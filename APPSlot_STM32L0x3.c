@@ -0,0 +1,392 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.8
+ *  File: APPSlot_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is the A/B slot handling of the app memory.
+ * APP_MEM is split into two slots of the same size in the linker file. The selector is a versioned constant (see NVMPatch_STM32L0x3.c) that holds which slot is active.
+ * An update is written into the inactive slot in the background, using the asynchronous mode of the NVM driver. The running code is never touched.
+ * Once the image is complete and verified, the switch is a single word write into the selector. If the power is lost at any point before that, we simply keep running the old slot.
+ *
+ * v.1.1
+ * Added the app_api dispatch table. It sits in the APP_API area of the linker file, which is at the same address in every build.
+ * A function in the .app_section that calls HAL_Delay through the table only holds the absolute address of the table in its literal pool instead of a PC-relative BL. Such code can be written into any slot (or any address) as it is.
+ *
+ * v.1.2
+ * Added the RAM loader. The .app_section of the active slot is copied into APP_RAM at boot and every time the FLASH copy changes, and the functions are called from there.
+ * This way the patched functions run with zero wait states and don't stall while the FLASH is busy with the next update (as long as the helpers they call through app_api don't touch the FLASH either).
+ *
+ * v.1.3
+ * The slot switch is a separate function, so an image written by someone else (e.g. the USART2 image receiver) can be activated too.
+ *
+ * v.1.4
+ * Added an image footer in the last page of each slot: length and CRC of the image. The background update writes it before switching and the boot checks the active slot with a single CRC pass over it.
+ * The update is verified with the CRC peripheral instead of a memcmp.
+ *
+ * v.1.5
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.6
+ * The footer is written as the last half page of the slot with FLASHUpd_HalfPageStreamBank instead of word by word, and a failed erase/write is reported.
+ *
+ * v.1.7
+ * APP_UpdateCommit checks the selector write and marks the update as failed if the footer or the selector can't be written.
+ *
+ * v.1.8
+ * The selector keeps its value through a renewal of its page, see NVMVConst_Write.
+ *
+ */
+
+#include "APPSlot_STM32L0x3.h"
+#include "main.h"
+#include "string.h"
+
+//Selector of the active slot, slot A by default
+NVM_VCONST(app_slot_select, APP_SLOT_A);
+
+//Background update state
+APPSlot_Update_TypeDef APP_update = {0};
+
+//RAM copy state
+APPSlot_Ram_TypeDef APP_ram = {0};
+
+//Dispatch table for the .app_section functions
+__attribute__((section(".app_api"), used)) const APP_Api_TypeDef app_api = {
+		APP_API_VERSION,
+		HAL_Delay,
+		HAL_GetTick,
+		NVMVConst_Read
+};
+
+static void APP_UpdateFill(void);
+
+
+//1)Active and inactive slots
+uint32_t APP_ActiveSlotBase(void) {
+	/**
+	 * Returns the start address of the slot the selector points to.
+	 * Note: the selector has two pages, so it still reads its last value while one of them is being renewed. A blank selector (0) would mean it was never written, we fall back to slot A then.
+	 **/
+
+	if(NVMVConst_Read(app_slot_select) == APP_SLOT_B) return (uint32_t)&__app_slot_b_start__;
+	return (uint32_t)&__app_slot_a_start__;
+}
+
+uint32_t APP_InactiveSlotBase(void) {
+	if(APP_ActiveSlotBase() == (uint32_t)&__app_slot_a_start__) return (uint32_t)&__app_slot_b_start__;
+	return (uint32_t)&__app_slot_a_start__;
+}
+
+
+//2)Address of a function within the active slot
+uint32_t APP_SlotAddr(uint32_t linked_addr) {
+	/**
+	 * Functions in the .app_section are linked to slot A. This function moves the address - with the Thumb bit - into the active slot.
+	 **/
+
+	return linked_addr - (uint32_t)&__app_slot_a_start__ + APP_ActiveSlotBase();
+}
+
+
+//3)Fix the BL instructions of an image that is moved to another slot
+void APP_RelocateBL(uint32_t* image_ptr, uint32_t word_cnt, uint32_t old_base, uint32_t new_base) {
+	/**
+	 * A BL is PC relative. If the code is moved to another address, every BL that calls a function outside the image (e.g. HAL_Delay) must be adjusted - these are the words 7 and 13 of Data_buf that had to be fixed by hand.
+	 * We look for the two halfwords of a BL (11110 and 11x11 prefixes), decode the target, and re-encode it for the new address. Calls within the image are moved together with the code and are not touched.
+	 *
+	 * Note: this is a scan of the machine code, so a literal in the image that looks like a BL would be changed too. Only use it on images that are code, such as Blink_custom.
+	 **/
+
+	uint16_t* hw_ptr = (uint16_t*)image_ptr;
+	uint32_t hw_cnt = word_cnt * 2;
+	uint32_t image_end = old_base + (word_cnt * 4);
+
+	for(uint32_t i = 0; (i + 1) < hw_cnt; i++) {
+
+		uint16_t hw1 = hw_ptr[i];
+		uint16_t hw2 = hw_ptr[i + 1];
+		if(((hw1 & 0xF800) != 0xF000) || ((hw2 & 0xD000) != 0xD000)) continue;
+
+		uint32_t s = (hw1 >> 10) & 1;
+		uint32_t i1 = (~(((hw2 >> 13) & 1) ^ s)) & 1;
+		uint32_t i2 = (~(((hw2 >> 11) & 1) ^ s)) & 1;
+		int32_t offset = (int32_t)((s << 24) | (i1 << 23) | (i2 << 22) | ((uint32_t)(hw1 & 0x3FF) << 12) | ((uint32_t)(hw2 & 0x7FF) << 1));
+		if(s == 1) offset |= (int32_t)0xFE000000;	//sign extension from 25 bits
+
+		uint32_t target = old_base + (i * 2) + 4 + offset;
+		if((target >= old_base) && (target < image_end)) {
+			i++;
+			continue;							//call within the image, moves with it
+		}
+
+		int32_t new_offset = (int32_t)(target - (new_base + (i * 2) + 4));
+		s = ((uint32_t)new_offset >> 24) & 1;
+		uint32_t j1 = ((~((uint32_t)new_offset >> 23)) ^ s) & 1;
+		uint32_t j2 = ((~((uint32_t)new_offset >> 22)) ^ s) & 1;
+		hw_ptr[i] = (uint16_t)(0xF000 | (s << 10) | (((uint32_t)new_offset >> 12) & 0x3FF));
+		hw_ptr[i + 1] = (uint16_t)(0xD000 | (j1 << 13) | (j2 << 11) | (((uint32_t)new_offset >> 1) & 0x7FF));
+		i++;
+	}
+}
+
+
+//4)Start writing an image into the inactive slot
+uint8_t APP_UpdateStart(uint32_t* src_ptr, uint32_t word_cnt) {
+	/**
+	 * The image is written into the inactive slot in the background: the pages are erased and programmed by the asynchronous mode of the NVM driver, refilling its queue from the completion callback.
+	 * The image must be built (or relocated, see APP_RelocateBL) for the inactive slot.
+	 * APP_update.state goes to APP_UPDATE_READY when the image is written. Then APP_UpdateCommit switches the slots.
+	 *
+	 * Returns 1 if the update has started, 0 if an update or another asynchronous operation is already running, or the image doesn't fit.
+	 *
+	 * Note: the image MUST be in RAM and remain untouched until APP_UpdateCommit.
+	 **/
+
+	if((APP_update.state == APP_UPDATE_WRITING) || (NVM_AsyncBusy() == 1)) return 0;
+	if((word_cnt == 0) || ((word_cnt * 4) > ((uint32_t)&__app_slot_size__ - APP_FOOTER_RESERVED))) return 0;
+
+	APP_update.src_ptr = src_ptr;
+	APP_update.word_cnt = word_cnt;
+	APP_update.next_word = 0;
+	APP_update.dst_base = APP_InactiveSlotBase();
+	APP_update.state = APP_UPDATE_WRITING;
+
+	APP_UpdateFill();
+
+	return 1;
+}
+
+
+//5)Verify the image and switch to it
+uint8_t APP_UpdateCommit(void) {
+	/**
+	 * Compares the inactive slot with the image (CRC) and, if they match, writes the footer and points the selector to the inactive slot.
+	 * The selector is a versioned constant, so the switch is a single word write.
+	 *
+	 * Returns 1 if we have switched, 0 if there was no finished update, the verification failed or the footer/selector could not be written.
+	 **/
+
+	if(APP_update.state != APP_UPDATE_READY) return 0;
+
+	if(FLASHVerify(APP_update.dst_base, APP_update.src_ptr, APP_update.word_cnt) != NVM_OK) {
+		APP_update.state = APP_UPDATE_FAILED;
+		return 0;
+	}
+
+	if((APP_WriteFooter(APP_update.dst_base, APP_update.word_cnt, CRC_Calc(APP_update.src_ptr, APP_update.word_cnt)) == 0)
+			|| (APP_SwitchToSlot(APP_update.dst_base) == 0)) {
+		APP_update.state = APP_UPDATE_FAILED;
+		return 0;
+	}											//Note: the old slot stays active, the selector still points to it
+
+	APP_update.state = APP_UPDATE_IDLE;
+
+	return 1;
+}
+
+
+//6)Background update - completion callback
+static void APP_UpdateCallback(uint8_t status) {
+	/**
+	 * Called from the FLASH IRQ each time the asynchronous queue is done. We either queue the next part of the image or declare the image ready.
+	 **/
+
+	if(status != 0) {
+		APP_update.state = APP_UPDATE_FAILED;
+		return;
+	}
+
+	if(APP_update.next_word < APP_update.word_cnt) {
+		APP_UpdateFill();
+	} else {
+		APP_update.state = APP_UPDATE_READY;
+	}
+}
+
+
+//7)Background update - queue filling
+static void APP_UpdateFill(void) {
+	/**
+	 * We put as many operations into the asynchronous queue as it takes, then start it.
+	 * At the start of each page we queue an erase (unless the page is already blank), then the full half pages, then the remaining words one-by-one.
+	 * One queue entry must always be left for a half page or word operation, so a page is never erased without anything being queued after it.
+	 **/
+
+	while(APP_update.next_word < APP_update.word_cnt) {
+
+		uint32_t dst_addr = APP_update.dst_base + (APP_update.next_word * 4);
+		uint32_t remaining_word_cnt = APP_update.word_cnt - APP_update.next_word;
+
+		if(((dst_addr & NVM_CFG_PAGE_MASK) == 0) && (FLASHPage_IsBlank(dst_addr) == 0)) {
+			if(NVM_async.count >= (NVM_ASYNC_QUEUE_LEN - 1)) break;
+												//the erase goes into the next round, together with what follows it
+			NVM_AsyncQueue(NVM_OP_ERASE_PAGE, dst_addr, 0, 0);
+		}
+
+		if(((dst_addr & NVM_CFG_HALF_PAGE_MASK) == 0) && (remaining_word_cnt >= NVM_CFG_HALF_PAGE_WORDS)) {
+			if(NVM_AsyncQueue(NVM_OP_HALF_PAGE, dst_addr, 0, &APP_update.src_ptr[APP_update.next_word]) == 0) break;
+			APP_update.next_word += NVM_CFG_HALF_PAGE_WORDS;
+		} else {
+			if(NVM_AsyncQueue(NVM_OP_WORD, dst_addr, APP_update.src_ptr[APP_update.next_word], 0) == 0) break;
+			APP_update.next_word++;
+		}
+	}
+
+	NVM_AsyncStart(APP_UpdateCallback);
+}
+
+
+
+//8)Copy the app into RAM
+uint8_t APP_LoadToRAM(void) {
+	/**
+	 * Copies the .app_section of the active slot into APP_RAM.
+	 * The code must be position independent (see app_dispatch), since it runs at a completely different address than it was linked to. PC-relative calls wouldn't even reach the FLASH from the RAM.
+	 *
+	 * Returns 1 on success, 0 if the .app_section doesn't fit into APP_RAM.
+	 *
+	 * Note: don't call it while a function of the RAM copy is running, e.g. from an IRQ. Use APP_RamInvalidate and APP_RamRefresh instead.
+	 **/
+
+	uint32_t app_size = (uint32_t)&__app_section_end__ - (uint32_t)&__app_section_start__;
+
+	if(app_size > (uint32_t)&__app_ram_size__) return 0;
+
+	memcpy((uint32_t*)&__app_ram_start__, (uint32_t*)(APP_ActiveSlotBase() + ((uint32_t)&__app_section_start__ - (uint32_t)&__app_slot_a_start__)), app_size);
+	__DSB();
+	__ISB();									//we make sure the new code is what gets fetched
+
+	APP_ram.loaded = 1;
+	APP_ram.reload = 0;
+
+	return 1;
+}
+
+
+//9)Address of a function within the RAM copy
+uint32_t APP_RamAddr(uint32_t linked_addr) {
+	/**
+	 * Moves the address of a function in the .app_section - with the Thumb bit - into its RAM copy.
+	 * Falls back to the active slot in FLASH if there is no RAM copy.
+	 **/
+
+	if(APP_ram.loaded == 0) return APP_SlotAddr(linked_addr);
+
+	return linked_addr - (uint32_t)&__app_section_start__ + (uint32_t)&__app_ram_start__;
+}
+
+
+//10)Mark the RAM copy as outdated
+void APP_RamInvalidate(void) {
+	/**
+	 * To be called after the FLASH copy of the .app_section has been changed (patch, versioned constant, slot switch). Safe to call from an IRQ.
+	 **/
+
+	APP_ram.reload = 1;
+}
+
+
+//11)Reload the RAM copy if it is outdated
+void APP_RamRefresh(void) {
+	/**
+	 * To be called from the main loop, between two calls of the RAM functions.
+	 **/
+
+	if((APP_ram.reload == 1) || (APP_ram.loaded == 0)) APP_LoadToRAM();
+}
+
+
+//12)Switch to a slot
+uint8_t APP_SwitchToSlot(uint32_t slot_base) {
+	/**
+	 * Points the selector to the slot starting at "slot_base". The selector is a versioned constant, so the switch is a single word write.
+	 * The image in the slot is not checked here, that is up to the caller.
+	 *
+	 * Returns 1 if the selector has been written, 0 if the address is not the start of a slot or the write failed.
+	 **/
+
+	uint32_t new_slot;
+
+	if(slot_base == (uint32_t)&__app_slot_b_start__) {
+		new_slot = APP_SLOT_B;
+	} else if(slot_base == (uint32_t)&__app_slot_a_start__) {
+		new_slot = APP_SLOT_A;
+	} else {
+		return 0;
+	}
+
+	if(NVMVConst_Write(app_slot_select, new_slot) == 0) return 0;
+	APP_RamInvalidate();						//the RAM copy must be taken from the new slot
+
+	return 1;
+}
+
+
+//13)Write the footer of a slot
+uint8_t APP_WriteFooter(uint32_t slot_base, uint32_t word_cnt, uint32_t image_crc) {
+	/**
+	 * Writes the footer into the last APP_FOOTER_WORDS words of the slot. The last page is erased first if it is not blank.
+	 * The footer is written as the last half page of the slot (the words before it stay 0, the erased value) with FLASHUpd_HalfPageStreamBank, so it is read-while-write if the slot is in the other bank.
+	 * "image_crc" is the CRC of the first "word_cnt" words of the slot, as it should be. We check it against the FLASH before writing, so a footer is never written for a broken image.
+	 *
+	 * Returns 1 on success, 0 if the image is too long, its CRC doesn't match or a write failed.
+	 **/
+
+	uint32_t footer_page_addr = slot_base + (uint32_t)&__app_slot_size__ - APP_FOOTER_RESERVED;
+	uint32_t footer_addr = slot_base + (uint32_t)&__app_slot_size__ - (APP_FOOTER_WORDS * 4);
+	uint32_t footer[APP_FOOTER_WORDS] = {APP_FOOTER_MAGIC, word_cnt, image_crc, ~image_crc};
+	uint32_t footer_half_page[NVM_CFG_HALF_PAGE_WORDS] = {0};
+	uint8_t status = NVM_OK;
+
+	for(uint8_t i = 0; i < APP_FOOTER_WORDS; i++) {
+		footer_half_page[NVM_CFG_HALF_PAGE_WORDS - APP_FOOTER_WORDS + i] = footer[i];
+	}
+
+	if((word_cnt == 0) || ((word_cnt * 4) > ((uint32_t)&__app_slot_size__ - APP_FOOTER_RESERVED))) return 0;
+	if(FLASHRegion_CRC(slot_base, word_cnt) != image_crc) return 0;
+
+	NVM_SessionBegin();
+	if(FLASHPage_IsBlank(footer_page_addr) == 0) status = FLASHErase_Page(footer_page_addr);
+	if(status == NVM_OK) status = FLASHUpd_HalfPageStreamBank(footer_half_page, footer_page_addr + NVM_CFG_HALF_PAGE_BYTES, NVM_CFG_HALF_PAGE_WORDS);
+	NVM_SessionEnd();
+
+	if(status != NVM_OK) return 0;
+
+	return (memcmp((uint32_t*)footer_addr, footer, sizeof(footer)) == 0) ? 1 : 0;
+}
+
+
+//14)Check the image of a slot
+uint8_t APP_SlotValid(uint32_t slot_base) {
+	/**
+	 * Returns 1 if the slot has a footer and the CRC of the image matches it, 0 otherwise.
+	 * This is one pass of the CRC peripheral over the image.
+	 **/
+
+	uint32_t* footer_ptr = (uint32_t*)(slot_base + (uint32_t)&__app_slot_size__ - (APP_FOOTER_WORDS * 4));
+
+	if(footer_ptr[0] != APP_FOOTER_MAGIC) return 0;
+	if(footer_ptr[2] != ~footer_ptr[3]) return 0;
+	if((footer_ptr[1] == 0) || ((footer_ptr[1] * 4) > ((uint32_t)&__app_slot_size__ - APP_FOOTER_RESERVED))) return 0;
+
+	return (FLASHRegion_CRC(slot_base, footer_ptr[1]) == footer_ptr[2]) ? 1 : 0;
+}
+
+
+//15)Boot check of the slots
+void APP_BootCheck(void) {
+	/**
+	 * To be called once at boot, before anything from the .app_section runs.
+	 * If the active slot is broken but the other one is fine, we switch to the other one.
+	 * If neither has a valid footer - e.g. the slot A image coming from the debugger has none - we keep the active slot as it is.
+	 **/
+
+	if(APP_SlotValid(APP_ActiveSlotBase()) == 1) return;
+
+	if(APP_SlotValid(APP_InactiveSlotBase()) == 1) APP_SwitchToSlot(APP_InactiveSlotBase());
+}
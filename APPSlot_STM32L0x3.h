@@ -0,0 +1,106 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.5
+ *  File: APPSlot_STM32L0x3.h
+ *
+ *      This is the double-buffered (A/B) handling of the app memory.
+ *      The code in the .app_section is linked to slot A. An update is written into the slot that is not running, then a selector word decides which slot is called.
+ *      The functions in the .app_section can call the rest of the code through the app_api dispatch table, so they contain no PC-relative calls and can be moved without fixups.
+ *      Such position independent code can also be copied into the APP_RAM area and run from there.
+ */
+
+#ifndef INC_APPSLOT_STM32L0x3_H_
+#define INC_APPSLOT_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+#include "NVMPatch_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define APP_SLOT_A					1			//selector values, 0 is the blank state and reads as slot A
+#define APP_SLOT_B					2
+
+#define APP_UPDATE_IDLE				0
+#define APP_UPDATE_WRITING			1
+#define APP_UPDATE_READY			2			//image is in the inactive slot, waiting for APP_UpdateCommit
+#define APP_UPDATE_FAILED			3
+
+//Calls a function of the .app_section from the active slot
+#define APP_Call(function)			((void (*)(void))APP_SlotAddr((uint32_t)(function)))()
+
+//Calls a function of the .app_section from its copy in APP_RAM
+#define APP_CallRAM(function)		((void (*)(void))APP_RamAddr((uint32_t)(function)))()
+
+#define APP_FOOTER_MAGIC			0x52544641	//"AFTR"
+#define APP_FOOTER_WORDS			4			//magic, image length in words, image CRC, inverted image CRC
+#define APP_FOOTER_RESERVED			NVM_CFG_PAGE_BYTES	//the last page of each slot holds the footer only, images must fit below it
+
+#define APP_API_VERSION				1			//to be stepped whenever the app_api layout changes
+
+//Helpers for the .app_section functions: through the dispatch table if "app_dispatch" is defined
+#ifdef app_dispatch
+#define APP_DELAY(ms)				app_api.delay(ms)
+#define APP_VCONST_READ(slots)		app_api.vconst_read(slots)
+#else
+#define APP_DELAY(ms)				HAL_Delay(ms)
+#define APP_VCONST_READ(slots)		NVMVConst_Read(slots)
+#endif
+
+#if defined(app_in_ram) && !defined(app_dispatch)
+#error "app_in_ram needs app_dispatch: the .app_section can only run from RAM if it has no PC-relative calls into the FLASH"
+#endif
+
+//LOCAL VARIABLE
+typedef struct {
+	uint32_t* src_ptr;							//image to write, in RAM
+	uint32_t word_cnt;							//length of the image
+	uint32_t next_word;							//next word to queue
+	uint32_t dst_base;							//start of the inactive slot
+	volatile uint8_t state;						//APP_UPDATE_ states
+} APPSlot_Update_TypeDef;
+
+typedef struct {
+	uint32_t version;							//APP_API_VERSION, an image can check it before running
+	void (*delay)(uint32_t ms);					//HAL_Delay
+	uint32_t (*get_tick)(void);					//HAL_GetTick
+	uint32_t (*vconst_read)(const uint32_t* slots);	//NVMVConst_Read
+} APP_Api_TypeDef;
+
+typedef struct {
+	volatile uint8_t reload;					//1 if the FLASH has changed since the last copy
+	uint8_t loaded;								//1 if APP_RAM holds a valid copy
+} APPSlot_Ram_TypeDef;
+
+//EXTERNAL VARIABLE
+extern APPSlot_Update_TypeDef APP_update;
+extern APPSlot_Ram_TypeDef APP_ram;
+extern const APP_Api_TypeDef app_api;
+extern const uint32_t app_slot_select [VCONST_SLOT_CNT];
+extern uint32_t __app_slot_a_start__;
+extern uint32_t __app_slot_b_start__;
+extern uint32_t __app_slot_size__;
+extern uint32_t __app_ram_start__;
+extern uint32_t __app_ram_size__;
+
+//FUNCTION PROTOTYPES
+uint32_t APP_ActiveSlotBase(void);
+uint32_t APP_InactiveSlotBase(void);
+uint32_t APP_SlotAddr(uint32_t linked_addr);
+void APP_RelocateBL(uint32_t* image_ptr, uint32_t word_cnt, uint32_t old_base, uint32_t new_base);
+uint8_t APP_UpdateStart(uint32_t* src_ptr, uint32_t word_cnt);
+uint8_t APP_UpdateCommit(void);
+uint8_t APP_LoadToRAM(void);
+uint32_t APP_RamAddr(uint32_t linked_addr);
+void APP_RamInvalidate(void);
+void APP_RamRefresh(void);
+uint8_t APP_SwitchToSlot(uint32_t slot_base);
+uint8_t APP_WriteFooter(uint32_t slot_base, uint32_t word_cnt, uint32_t image_crc);
+uint8_t APP_SlotValid(uint32_t slot_base);
+void APP_BootCheck(void);
+
+#endif /* INC_APPSLOT_STM32L0x3_H_ */
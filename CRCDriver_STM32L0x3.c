@@ -0,0 +1,97 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.2
+ *  File: CRCDriver_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a driver for the CRC peripheral.
+ * The peripheral takes a 32-bit word per AHB write and is done with it within the same cycle, so hashing a buffer is as fast as reading it.
+ *
+ * v.1.1
+ * CRC_Accumulate initialises the peripheral if its clock is not on yet, so the FLASH verification doesn't depend on the init order.
+ *
+ * v.1.2
+ * CRC_Calc feeds the buffer in CRC_CHUNK_WORDS pieces, so a long buffer (e.g. the image CRC of APP_UpdateCommit) doesn't mask the IRQs for its whole length.
+ *
+ */
+
+#include "CRCDriver_STM32L0x3.h"
+
+
+//1)CRC peripheral initialisation
+void CRCInit(void) {
+	/**
+	 * 1)Enable the clock
+	 * 2)Reset settings: default polynomial and initial value, 32-bit polynomial, no reversal
+	 **/
+
+	//1)
+	RCC->AHBENR |= (1<<12);						//CRC clock enabled (CRCEN)
+
+	//2)
+	CRC->CR = 0;								//32-bit polynomial, no input/output reversal
+	CRC->INIT = CRC_INITIAL_VALUE;
+	CRC->POL = 0x04C11DB7;
+}
+
+
+//2)Continue a CRC over a buffer
+uint32_t CRC_Accumulate(uint32_t crc_value, const uint32_t* data_ptr, uint32_t word_cnt) {
+	/**
+	 * Continues the CRC "crc_value" over "word_cnt" words from "data_ptr" and returns the new value. The buffer can be in RAM or in FLASH.
+	 * Since there is no final XOR, the CRC of a long area can be calculated piece by piece: the result of one call is the "crc_value" of the next one.
+	 *
+	 * The IRQs are masked while the peripheral is in use, so an IRQ can use it too without corrupting what the main code is doing. Keep "word_cnt" short (a few hundred words) to keep the masked window short.
+	 *
+	 * 1)Load the value to continue from as initial value and reset the calculation unit
+	 * 2)Feed the words
+	 * 3)Restore the default initial value
+	 **/
+
+	if((RCC->AHBENR & (1<<12)) == 0) CRCInit();	//the CRC clock is not running yet
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	//1)
+	CRC->INIT = crc_value;
+	CRC->CR |= (1<<0);							//RESET, loads INIT into DR, cleared by hardware
+
+	//2)
+	for(uint32_t i = 0; i < word_cnt; i++) {
+		CRC->DR = data_ptr[i];
+	}
+	crc_value = CRC->DR;
+
+	//3)
+	CRC->INIT = CRC_INITIAL_VALUE;
+
+	__set_PRIMASK(primask);
+
+	return crc_value;
+}
+
+
+//3)CRC of a buffer
+uint32_t CRC_Calc(const uint32_t* data_ptr, uint32_t word_cnt) {
+	/**
+	 * Returns the CRC of "word_cnt" words from "data_ptr", starting from the initial value 0xFFFFFFFF.
+	 * The buffer is fed to CRC_Accumulate in CRC_CHUNK_WORDS pieces, so the IRQs are only masked for one piece at a time, however long the buffer is (e.g. a whole app image).
+	 **/
+
+	uint32_t crc_value = CRC_INITIAL_VALUE;
+	uint32_t chunk_word_cnt;
+
+	while(word_cnt != 0) {
+		chunk_word_cnt = (word_cnt > CRC_CHUNK_WORDS) ? CRC_CHUNK_WORDS : word_cnt;
+		crc_value = CRC_Accumulate(crc_value, data_ptr, chunk_word_cnt);
+		data_ptr = data_ptr + chunk_word_cnt;
+		word_cnt = word_cnt - chunk_word_cnt;
+	}
+
+	return crc_value;
+}
@@ -0,0 +1,32 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.1
+ *  File: CRCDriver_STM32L0x3.h
+ *
+ *      This is a driver for the CRC peripheral.
+ *      It is used with its reset settings: CRC-32 polynomial 0x04C11DB7, initial value 0xFFFFFFFF, 32-bit input words, no bit reversal, no final XOR (CRC-32/MPEG-2 over little endian words).
+ */
+
+#ifndef INC_CRCDRIVER_STM32L0x3_H_
+#define INC_CRCDRIVER_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+//LOCAL CONSTANT
+#define CRC_INITIAL_VALUE			0xFFFFFFFF
+#define CRC_CHUNK_WORDS				64			//words hashed with the IRQs masked at a time by CRC_Calc
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+void CRCInit(void);
+uint32_t CRC_Accumulate(uint32_t crc_value, const uint32_t* data_ptr, uint32_t word_cnt);
+uint32_t CRC_Calc(const uint32_t* data_ptr, uint32_t word_cnt);
+
+#endif /* INC_CRCDRIVER_STM32L0x3_H_ */
@@ -3,7 +3,7 @@
  *  Author: BalazsFarkas
  *  Project: STM32_NVMDriver
  *  Processor: STM32L053R8
- *  Program version: 1.0
+ *  Program version: 2.3
  *  File: EXTIDriver_STM32L0x3.c
  *  Change history:
  *
@@ -11,10 +11,54 @@
  *	Below is the definition and the setup of the EXTI channels.
  *	Callback function names are taken from the device startup file.
  *	Current version uses PC13 and EXTI13 to engage the blue push button on the L053R8 nucelo board.
+ *
+ *v.1.1
+ *	The FLASH update in the EXTI13 callback runs within a single NVM session.
+ *
+ *v.1.2
+ *	Added the "delta_update" option to the EXTI13 callback.
+ *
+ *v.1.3
+ *	Added the "patch_table" option to the EXTI13 callback, where the Blink_custom delay is patched by name.
+ *
+ *v.1.4
+ *	Added the "versioned_const" option to the EXTI13 callback, where the Blink_custom delay is a versioned constant.
+ *
+ *v.1.5
+ *	Added the "ab_slots" option to the EXTI13 callback, where the changed Blink_custom is written into the inactive app slot.
+ *
+ *v.1.6
+ *	With the "app_in_ram" option, the RAM copy of Blink_custom is marked outdated after each update.
+ *
+ *v.1.7
+ *	Added the "dma_half_page" option, where the half page burst is loaded into the FLASH by the DMA.
+ *
+ *v.1.8
+ *	Added the "nvm_journal" option, where the Blink_custom page is rewritten through the write-ahead journal, so a power loss can't leave it erased.
+ *
+ *v.1.9
+ *	The address of Blink_custom comes from NVMConfig.
+ *
+ *v.2.0
+ *	The update is in EXTI_BlinkUpdate. With the "nvm_work_queue" option, the IRQ only posts it to the deferred work queue.
+ *
+ *v.2.1
+ *	The current delay is read through a read view of slot A instead of a raw pointer.
+ *
+ *v.2.2
+ *	The half page size comes from NVMConfig.
+ *
+ *v.2.3
+ *	The "ab_slots" option finds the delays in the copied image by their encoding instead of fixed word indices. It is picked before "patch_table", since the patch table can only patch slot A in place.
  */
 
 
 #include "EXTIDriver_STM32L0x3.h"
+#include "NVMDriver_STM32L0x3.h"
+#include "NVMPatch_STM32L0x3.h"
+#include "APPSlot_STM32L0x3.h"
+#include "NVMJournal_STM32L0x3.h"
+#include "NVMWork_STM32L0x3.h"
 
 //1)We initialize the EXTIs
 void EXTIInit(void){
@@ -77,62 +121,152 @@ void EXTI4_15_IRQHandler (void) {
 	if (EXTI->PR & (1<<13)) {
 
 		//2)
+#ifdef nvm_work_queue
+		NVMWork_Post(NVM_WORK_BLINK_UPDATE);		//the update runs from the main loop, once the button has stopped bouncing
+#else
+		EXTI_BlinkUpdate();
+#endif
+
+		//3)
+		EXTI->PR |= (1<<13);						//we reset the IRQ connected to the EXTI13 by writing to the pending bit
+	}
+}
+
+
+//3)We rewrite the Blink_custom delays
+void EXTI_BlinkUpdate(void) {
+	/*
+	 * The update of the EXTI13 callback. With the "nvm_work_queue" define, it is run by NVMWork_Run from the main loop, otherwise straight from the IRQ.
+	 *
+	 * */
 
-		  //the address we wish to erase
-		  uint32_t flash_page_addr = 0x0800C000;
+#if defined(ab_slots) && (defined(patch_table) || !defined(versioned_const))
+	//A/B slots: we copy Blink_custom from the active slot, change the delays, move the BLs and write it into the inactive slot in the background
+	//Note: the switch to the new slot is done in the main loop by APP_UpdateCommit, once the image is written
+	//Note: the delays are found in the copy by their "movs; lsls" encoding, so the layout of Blink_custom (dispatch table, patch table) doesn't matter
+	//Note: with "versioned_const" alone, the delay is not in the image at all, it is changed in its slots below
+	if (APP_update.state != APP_UPDATE_WRITING) {
+		uint32_t* active_ptr = (uint32_t*)APP_ActiveSlotBase();
 
-		  //We check, which value we have been running with (delay values are stored at C014 and C030)
-		  uint32_t* toggle_pointer = 0x0800C014;
-		  toggle_value1 = *toggle_pointer;
+		for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) Data_buf[i] = active_ptr[i];
 
-		  if (toggle_value1 == 0x00DB23FA) {			//if we were at 2000 ms
-			  toggle_value1 = 0x005B23FA;
-			  toggle_value2 = 0x0018005B;
-		  } else {										//if not
-			  toggle_value1 = 0x00DB23FA;
-			  toggle_value2 = 0x001800DB;
-		  }
+		if (NVMPatch_ImageReplace(Data_buf, NVM_CFG_HALF_PAGE_WORDS, 2000, 500) == 0) {
+			if (NVMPatch_ImageReplace(Data_buf, NVM_CFG_HALF_PAGE_WORDS, 500, 2000) == 0) return;
+		}											//toggle between 2000 ms and 500 ms, an image without the delays is not written
 
-		  Data_buf [5] = toggle_value1;					//we update the machine code
+#ifndef app_dispatch
+		APP_RelocateBL(Data_buf, NVM_CFG_HALF_PAGE_WORDS, APP_ActiveSlotBase(), APP_InactiveSlotBase());
+#endif																//Note: with the dispatch table, Blink_custom has no BLs to move
+		APP_UpdateStart(Data_buf, NVM_CFG_HALF_PAGE_WORDS);
+	}
+
+#elif defined(patch_table)
+	//patch table: we look up the delay constant of Blink_custom by name and rewrite only its encoding
+	//Note: no machine code image and no pointer fixups are needed, the table follows the code when it is rebuilt
+	uint32_t blink_delay;
+
+	if ((NVMPatch_Read("blink_delay", &blink_delay) == 1) && (blink_delay == 2000)) {
+		blink_delay = 500;
+	} else {
+		blink_delay = 2000;
+	}
+
+	NVMPatch_Write("blink_delay", blink_delay);	//both delays of Blink_custom share the name, so they are changed together
+
+#elif defined(versioned_const)
+	//versioned constant: the new delay goes into the next blank slot with a single word write, no erase
+	//Note: a page is only erased once all the slots of the other one are used up
+	if (NVMVConst_Read(blink_delay_slots) == 2000) {
+		NVMVConst_Write(blink_delay_slots, 500);
+	} else {
+		NVMVConst_Write(blink_delay_slots, 2000);
+	}
+
+#else
+	//the address we wish to erase
+	uint32_t flash_page_addr = NVM_CFG_APP_SLOT_A;
+
+	//We check, which value we have been running with (delay values are stored at C014 and C030)
+	NVM_View_TypeDef blink_view;
+	if(NVM_ViewOpen(&blink_view, NVM_CFG_APP_SLOT_A, NVM_CFG_HALF_PAGE_WORDS) != NVM_OK) return;
+												//the first half page of slot A, read in place
+	toggle_value1 = NVM_VIEW_WORD(&blink_view, 5);
+
+	if (toggle_value1 == 0x00DB23FA) {			//if we were at 2000 ms
+		toggle_value1 = 0x005B23FA;
+		toggle_value2 = 0x0018005B;
+	} else {										//if not
+		toggle_value1 = 0x00DB23FA;
+		toggle_value2 = 0x001800DB;
+	}
 
-		  Data_buf [12] = toggle_value2;
+	Data_buf [5] = toggle_value1;					//we update the machine code
 
-		  //When the trigger happens, we replace the timing of the blink depending on what the original value was.
-		  //Since this modification occurs directly in FLASH, the result will be carried over even after unpowering the system and won't be lost.
-		  //Note: the machine code below may not be right if the original stack is changed and thus the pointers within the machine code would be pointing at the wrong place.
+	Data_buf [12] = toggle_value2;
 
-		  //We erase the area where the Blink_custom is
-		  FLASHErase_Page(flash_page_addr);
+	//When the trigger happens, we replace the timing of the blink depending on what the original value was.
+	//Since this modification occurs directly in FLASH, the result will be carried over even after unpowering the system and won't be lost.
+	//Note: the machine code below may not be right if the original stack is changed and thus the pointers within the machine code would be pointing at the wrong place.
 
-		  //We rewrite the Blink_custom machine code
-		  //Note: the machine code below may change between code optimisation. One machine code may not work for another code.
-		  //Note: machine code should always be changed bulk!!!
+#ifdef delta_update
+	//delta update: only the half pages that differ from what is in the FLASH are rewritten
+	//Note: the page is only erased if one of the changed words is not blank
+	Data_buf [7] = 0x23A0FEB7;
+	Data_buf [13] = 0xFEAAF7F4;
+	FLASHUpd_Delta(Data_buf, flash_page_addr, NVM_CFG_HALF_PAGE_WORDS);
+
+#elif defined(nvm_journal)
+	//journaled rewrite: the new half page is staged and recorded before the page is erased
+	//Note: if the power drops in between, NVMJournal_Recover finishes the rewrite at the next boot. The second half of the page is kept.
+	Data_buf [7] = 0x23A0FEB7;
+	Data_buf [13] = 0xFEAAF7F4;
+	NVMJournal_PageWrite(flash_page_addr, Data_buf, NVM_CFG_HALF_PAGE_WORDS);
+
+#else
+	//We open an NVM session so the erase and the rewrite go through the unlock sequence only once
+	NVM_SessionBegin();
+
+	//We erase the area where the Blink_custom is
+	FLASHErase_Page(flash_page_addr);
+
+	//We rewrite the Blink_custom machine code
+	//Note: the machine code below may change between code optimisation. One machine code may not work for another code.
+	//Note: machine code should always be changed bulk!!!
 
 #ifdef word_by_word
-		  //half-page write using individual words
-		  //Note: this version is 16 times slower than using a half-page burst. On the upside, it is very reliable.
+	//half-page write using individual words
+	//Note: this version is 16 times slower than using a half-page burst. On the upside, it is very reliable.
 
-		  //The two values below are pointers within the machine code that will also need to be updated if we change between half-page burst and word-by-word writing.
-		  Data_buf [7] = 0x23A0FF07;
-		  Data_buf [13] = 0xFEFAF7F4;
+	//The two values below are pointers within the machine code that will also need to be updated if we change between half-page burst and word-by-word writing.
+	Data_buf [7] = 0x23A0FF07;
+	Data_buf [13] = 0xFEFAF7F4;
 
 
-		  uint32_t* Data_buf_ptr = Data_buf;
-		  for(int i = 0; i < 16; i++) {					//copying is done word by word. We do need to loop for 16 to reach half a page
-			FLASHUpd_Word(flash_page_addr, *Data_buf_ptr++);
-			flash_page_addr = flash_page_addr + 4;		//we increment the address value by 4. Of not, flash_page_addr is constant, not an array!
-		  }
+	uint32_t* Data_buf_ptr = Data_buf;
+	for(int i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {	//copying is done word by word. We do need to loop for 16 to reach half a page
+		FLASHUpd_Word(flash_page_addr, *Data_buf_ptr++);
+		flash_page_addr = flash_page_addr + 4;		//we increment the address value by 4. Of not, flash_page_addr is constant, not an array!
+	}
 #endif
 
 //#ifdef half_page
-		  //half-page full burst
-		  Data_buf [7] = 0x23A0FEB7;
-		  Data_buf [13] = 0xFEAAF7F4;
-		  FLASHUpd_HalfPage(flash_page_addr);
+	//half-page full burst
+	Data_buf [7] = 0x23A0FEB7;
+	Data_buf [13] = 0xFEAAF7F4;
+#ifdef dma_half_page
+	FLASHUpd_HalfPageDMA(Data_buf, flash_page_addr, 1);
+											//IRQs with priority 1 or less important (EXTI4_15, FLASH) are masked while the DMA loads the latch, priority 0 remains active
+#else
+	FLASHUpd_HalfPage(flash_page_addr);
+#endif
 //#endif
 
+	NVM_SessionEnd();
+#endif
+#endif
 
-		  //3)
-		  EXTI->PR |= (1<<13);						//we reset the IRQ connected to the EXTI13 by writing to the pending bit
-	}
+
+#ifdef app_in_ram
+	APP_RamInvalidate();							//the RAM copy of Blink_custom is refreshed by the main loop
+#endif
 }
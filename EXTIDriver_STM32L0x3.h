@@ -3,7 +3,7 @@
  *  Author: BalazsFarkas
  *  Project: STM32_NVMDriver
  *  Processor: STM32L053R8
- *  HEader version: 1.0
+ *  HEader version: 1.3
  *  File: EXTIDriver_STM32L0x3.h
  *
  *      This is a driver for external interrupts.
@@ -14,18 +14,21 @@
 #define INC_EXTIDRIVER_CUSTOM_H_
 
 #include "stm32l053xx.h"											//device specific header file for registers
+#include "NVMConfig_STM32L0x3.h"
 
 //LOCAL CONSTANT
 
 //LOCAL VARIABLE
 
 //EXTERNAL VARIABLE
-extern uint32_t Data_buf [16];
+extern uint32_t Data_buf [NVM_CFG_HALF_PAGE_WORDS];
 extern uint32_t toggle_value1;
 extern uint32_t toggle_value2;
+extern const uint32_t blink_delay_slots [NVM_CFG_PAGE_WORDS * 2];	//the two pages of a versioned constant (VCONST_SLOT_CNT)
 
 //FUNCTION PROTOTYPES
 
 void EXTIInit(void);
+void EXTI_BlinkUpdate(void);
 
 #endif /* INC_EXTIDRIVER_CUSTOM_H_ */
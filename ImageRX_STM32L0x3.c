@@ -0,0 +1,307 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.6
+ *  File: ImageRX_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a receiver that writes an image arriving over USART2 directly into the FLASH.
+ * DMA1 channel 5 moves the received bytes into a circular buffer of two frames. The half transfer and transfer complete IRQs tell us that one frame is in, so we can write it while the DMA fills the other one.
+ * An erase plus a half page takes about 6.4 ms for every two frames, while two frames take 12.5 ms at 115200 baud. The transfer is thus limited by the link, not by the FLASH.
+ *
+ * Every frame is 72 bytes: SOF, type, 16-bit sequence number (LSB first), 64 bytes of payload and the CRC of the first 68 bytes (see CRCDriver, little endian words).
+ * The first frame (sequence 0) is a start frame with the destination and the number of data frames, then come the data frames (1 to n) and an end frame (n+1).
+ * Each frame is answered with ACK or NAK plus the sequence number we expect next. The sender may have at most two frames without an answer, since we only have two buffers. On a NAK it goes back to the expected sequence number.
+ * If a frame is broken (bad SOF or CRC), the reception is restarted once the line goes idle, so the next frame sent lands at the start of the buffer again.
+ *
+ * v.1.1
+ * The end frame carries the length and the CRC of the whole image. If the image goes to the start of a slot, the CRC is checked against the FLASH and the slot footer is written (see APP_WriteFooter).
+ *
+ * v.1.2
+ * The start frame also tells the byte order of the image. A byte swapped image is swapped on the fly by the stream writer, the frames are not touched.
+ *
+ * v.1.3
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.4
+ * The destination must be page aligned and, without A/B slots, in slot B (slot A is running). The frame count is checked in 32 bits before it is used. The IRQ handlers only exist with "image_rx", and printf stays off USART2 while an image is received.
+ *
+ * v.1.5
+ * The data frames are written with FLASHUpd_HalfPageStreamBank, so a slot in the other bank is written read-while-write. A swapped payload is swapped in the frame buffer once its CRC has been checked.
+ *
+ * v.1.6
+ * The data frames go through FLASHUpd_HalfPageStreamBankOrder with the byte order of the image, so the payload is swapped on the fly again instead of in the frame buffer.
+ *
+ */
+
+#include "ImageRX_STM32L0x3.h"
+
+//Receiver state
+ImageRX_TypeDef ImageRX = {0};
+
+//Double buffer of the DMA
+static uint32_t ImageRX_frame_buf [2][IMGRX_FRAME_WORDS];
+
+
+//0)Local helpers
+static void ImageRX_Reply(uint8_t reply_code) {
+	/**
+	 * Sends the reply and the expected sequence number. The three bytes are written directly to the USART, so this can be used from the IRQ.
+	 **/
+
+	uint8_t reply[3] = {reply_code, (uint8_t)(ImageRX.next_seq & 0xFF), (uint8_t)(ImageRX.next_seq >> 8)};
+
+	for(uint8_t i = 0; i < 3; i++) {
+		while(!((USART2->ISR & (1<<7)) == (1<<7)));	//we wait until TXE is 1
+		USART2->TDR = reply[i];
+	}
+}
+
+static void ImageRX_DMAStart(void) {
+	DMA1_Channel5->CCR &= ~(1<<0);				//channel disabled
+	DMA1->IFCR = (0xF<<16);						//we clear all the flags of channel 5
+	DMA1_Channel5->CNDTR = 2 * IMGRX_FRAME_BYTES;
+	DMA1_Channel5->CCR |= (1<<0);				//channel enabled
+}
+
+static uint8_t ImageRX_DstValid(uint32_t dst_addr, uint32_t chunk_cnt) {
+	/**
+	 * The image must go into a slot that is not running. With A/B slots, it must go to the start of the slot that is not running. Without them, the app runs from slot A, so only slot B is accepted.
+	 * The destination must be page aligned: a page is erased when the first half of it comes in, so an image can't start in the middle of a page.
+	 * "chunk_cnt" is the 32-bit word of the start frame. It is checked before anything is multiplied, so a huge count can't wrap the end address around.
+	 **/
+
+#ifdef ab_slots
+	uint32_t region_start = (uint32_t)&__app_slot_a_start__;
+#else
+	uint32_t region_start = (uint32_t)&__app_slot_b_start__;
+#endif
+	uint32_t region_end = (uint32_t)&__app_slot_b_start__ + (uint32_t)&__app_slot_size__;
+
+	if((dst_addr & NVM_CFG_PAGE_MASK) != 0) return 0;	//page alignment
+	if((dst_addr < region_start) || (dst_addr >= region_end)) return 0;
+	if(chunk_cnt > ((region_end - dst_addr) / NVM_CFG_HALF_PAGE_BYTES)) return 0;
+												//Note: this also keeps chunk_cnt within the 16-bit sequence numbers
+#ifdef ab_slots
+	if(dst_addr != APP_InactiveSlotBase()) return 0;
+	if((chunk_cnt * NVM_CFG_HALF_PAGE_BYTES) > ((uint32_t)&__app_slot_size__ - APP_FOOTER_RESERVED)) return 0;
+												//the last page of the slot is for the footer
+#endif
+
+	return 1;
+}
+
+
+//1)Receiver initialisation
+void ImageRXInit(void) {
+	/**
+	 * USART2 is already set up by MX_USART2_UART_Init. Here we only connect it to the DMA.
+	 *
+	 * 1)Clocks and the CRC
+	 * 2)DMA1 channel 5 to USART2_RX, circular, byte wide, IRQ at half and full transfer
+	 * 3)USART2 RX DMA request and idle line IRQ
+	 * 4)NVIC
+	 * 5)Start
+	 *
+	 * Note: the DMA IRQ has a lower priority than the FLASH IRQ, since it waits for the FLASH to finish.
+	 * Note: the receiver takes USART2 over. Its RX belongs to the DMA from here on, so the "t"/"s" commands of the telemetry are not polled with "image_rx". printf is dropped while an image is being received (see __io_putchar), otherwise it would mix into the ACKs/NAKs.
+	 **/
+
+	//1)
+	RCC->AHBENR |= (1<<0);						//DMA clock enabled
+	CRCInit();
+
+	//2)
+	DMA1_Channel5->CCR = 0;
+	DMA1_CSELR->CSELR &= ~(0xF<<16);
+	DMA1_CSELR->CSELR |= (4<<16);				//channel 5 is USART2_RX (C5S)
+	DMA1_Channel5->CPAR = (uint32_t)&USART2->RDR;
+	DMA1_Channel5->CMAR = (uint32_t)ImageRX_frame_buf;
+	DMA1_Channel5->CCR |= (2<<12);				//high priority (PL)
+	DMA1_Channel5->CCR |= (1<<7);				//memory increment (MINC)
+	DMA1_Channel5->CCR |= (1<<5);				//circular mode (CIRC)
+	DMA1_Channel5->CCR |= (1<<3);				//transfer error IRQ (TEIE)
+	DMA1_Channel5->CCR |= (1<<2);				//half transfer IRQ (HTIE)
+	DMA1_Channel5->CCR |= (1<<1);				//transfer complete IRQ (TCIE)
+												//Note: DIR is 0, we read the peripheral. MSIZE and PSIZE are 0, we move bytes.
+
+	//3)
+	USART2->CR3 |= (1<<6);						//DMA for the reception (DMAR)
+	USART2->ICR = (1<<4) | (1<<3);				//we clear the IDLE and ORE flags
+	USART2->CR1 |= (1<<4);						//idle line IRQ (IDLEIE)
+
+	//4)
+	NVIC_SetPriority(DMA1_Channel4_5_6_7_IRQn, 2);
+	NVIC_EnableIRQ(DMA1_Channel4_5_6_7_IRQn);
+	NVIC_SetPriority(USART2_IRQn, 2);
+	NVIC_EnableIRQ(USART2_IRQn);
+
+	//5)
+	ImageRX_Restart();
+}
+
+
+//2)Wait for a new image
+void ImageRX_Restart(void) {
+	/**
+	 * Drops whatever was being received and waits for a start frame.
+	 **/
+
+	ImageRX.state = IMGRX_IDLE;
+	ImageRX.resync = 0;
+	ImageRX.next_seq = 0;
+	ImageRX.chunk_cnt = 0;
+	ImageRX_DMAStart();
+}
+
+
+//3)Process one received frame
+static void ImageRX_Frame(uint32_t* frame_ptr) {
+	/**
+	 * Called from the DMA IRQ with the frame that has just come in.
+	 *
+	 * 1)Check the framing and the CRC. If they are wrong, we can't trust the sequence number either, so we restart the reception at the next idle line.
+	 * 2)Check the sequence number. A frame we have seen already is ACKed again (our ACK may have been lost), a frame from the future is NAKed.
+	 * 3)Act on the frame type
+	 **/
+
+	uint8_t* header = (uint8_t*)frame_ptr;
+	uint16_t seq = (uint16_t)(header[2] | (header[3] << 8));
+
+	//1)
+	if((header[0] != IMGRX_SOF) || (CRC_Calc(frame_ptr, IMGRX_FRAME_WORDS - 1) != frame_ptr[IMGRX_FRAME_WORDS - 1])) {
+		ImageRX.frame_err_cnt++;
+		DMA1_Channel5->CCR &= ~(1<<0);			//DMA stopped until the line is idle
+		ImageRX.resync = 1;
+		ImageRX_Reply(IMGRX_NAK);
+		return;
+	}
+
+	//2)
+	if((header[1] == IMGRX_TYPE_START) && (ImageRX.state != IMGRX_RECEIVING)) {
+		ImageRX.next_seq = 0;					//a start frame is accepted at any time when we are not already receiving
+	}
+
+	if(seq < ImageRX.next_seq) {
+		ImageRX_Reply(IMGRX_ACK);
+		return;
+	}
+
+	if(seq > ImageRX.next_seq) {
+		ImageRX_Reply(IMGRX_NAK);
+		return;
+	}
+
+	//3)
+	switch(header[1]) {
+		case IMGRX_TYPE_START:
+			if(ImageRX_DstValid(frame_ptr[1], frame_ptr[2]) == 0) {
+				ImageRX.state = IMGRX_FAILED;
+				ImageRX_Reply(IMGRX_NAK);
+				return;
+			}
+			ImageRX.dst_base = frame_ptr[1];
+			ImageRX.chunk_cnt = (uint16_t)frame_ptr[2];
+			ImageRX.byte_order = (frame_ptr[3] == NVM_BYTE_ORDER_SWAP) ? NVM_BYTE_ORDER_SWAP : NVM_BYTE_ORDER_NATIVE;
+			ImageRX.state = IMGRX_RECEIVING;
+			break;
+
+		case IMGRX_TYPE_DATA:
+			if((ImageRX.state != IMGRX_RECEIVING) || (seq > ImageRX.chunk_cnt)) {
+				ImageRX_Reply(IMGRX_NAK);
+				return;
+			}
+			{
+				uint32_t flash_addr = ImageRX.dst_base + ((uint32_t)(seq - 1) * NVM_CFG_HALF_PAGE_BYTES);
+				uint8_t status = NVM_OK;
+
+				NVM_SessionBegin();
+				if(((flash_addr & NVM_CFG_PAGE_MASK) == 0) && (FLASHPage_IsBlank(flash_addr) == 0)) {
+					status = FLASHErase_Page(flash_addr);	//first half of a page, the page is erased before it is written
+				}
+				if(status == NVM_OK) status = FLASHUpd_HalfPageStreamBankOrder(&frame_ptr[1], flash_addr, NVM_CFG_HALF_PAGE_WORDS, ImageRX.byte_order);
+										//read-while-write if the slot is in the other bank, a swapped payload is swapped on its way into the latch
+				NVM_SessionEnd();
+
+				if(status != NVM_OK) {
+					ImageRX.state = IMGRX_FAILED;
+					ImageRX_Reply(IMGRX_NAK);
+					return;
+				}
+			}
+			break;
+
+		case IMGRX_TYPE_END:
+			if((ImageRX.state != IMGRX_RECEIVING) || (seq != (ImageRX.chunk_cnt + 1))) {
+				ImageRX_Reply(IMGRX_NAK);
+				return;
+			}
+			if((ImageRX.dst_base == (uint32_t)&__app_slot_a_start__) || (ImageRX.dst_base == (uint32_t)&__app_slot_b_start__)) {
+				if(APP_WriteFooter(ImageRX.dst_base, frame_ptr[1], frame_ptr[2]) == 0) {
+					ImageRX.state = IMGRX_FAILED;	//the image in the FLASH is not what the sender has meant to send
+					ImageRX_Reply(IMGRX_NAK);
+					return;
+				}
+			}
+			ImageRX.state = IMGRX_DONE;
+			break;
+
+		default:
+			ImageRX_Reply(IMGRX_NAK);
+			return;
+	}
+
+	ImageRX.next_seq++;
+	ImageRX_Reply(IMGRX_ACK);
+}
+
+
+#ifdef image_rx
+//4)DMA IRQ
+void DMA1_Channel4_5_6_7_IRQHandler(void) {
+	/**
+	 * Half transfer: the first frame of the buffer is in. Transfer complete: the second one is.
+	 * If both are up, we were too slow (the sender ignored the two frame window). Both are still processed in order, the CRC catches an overwritten frame.
+	 **/
+
+	if((DMA1->ISR & (1<<19)) == (1<<19)) {		//TEIF5
+		DMA1->IFCR = (1<<19);
+		ImageRX.state = IMGRX_FAILED;
+		return;
+	}
+
+	if((DMA1->ISR & (1<<18)) == (1<<18)) {		//HTIF5
+		DMA1->IFCR = (1<<18);
+		ImageRX_Frame(ImageRX_frame_buf[0]);
+	}
+
+	if((DMA1->ISR & (1<<17)) == (1<<17)) {		//TCIF5
+		DMA1->IFCR = (1<<17);
+		if(ImageRX.resync == 0) ImageRX_Frame(ImageRX_frame_buf[1]);
+	}
+}
+
+
+//5)USART2 IRQ
+void USART2_IRQHandler(void) {
+	/**
+	 * Idle line: if a broken frame has stopped the reception, we start again at the beginning of the buffer.
+	 * An overrun (bytes coming in while the DMA is stopped) is simply cleared.
+	 **/
+
+	if((USART2->ISR & (1<<3)) == (1<<3)) {
+		USART2->ICR = (1<<3);					//we clear ORE
+	}
+
+	if((USART2->ISR & (1<<4)) == (1<<4)) {
+		USART2->ICR = (1<<4);					//we clear IDLE
+		if(ImageRX.resync == 1) {
+			ImageRX.resync = 0;
+			ImageRX_DMAStart();
+		}
+	}
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.3
+ *  File: ImageRX_STM32L0x3.h
+ *
+ *      This is a receiver for app images sent over USART2.
+ *      Frames are received by DMA into one half of a double buffer while the frame in the other half is written into the FLASH.
+ */
+
+#ifndef INC_IMAGERX_STM32L0x3_H_
+#define INC_IMAGERX_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+#include "CRCDriver_STM32L0x3.h"
+#include "APPSlot_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define IMGRX_FRAME_WORDS			(NVM_CFG_HALF_PAGE_WORDS + 2)	//header word, 16 payload words (a half page), CRC word
+#define IMGRX_FRAME_BYTES			(IMGRX_FRAME_WORDS * 4)
+#define IMGRX_SOF					0x55		//first byte of every frame
+
+#define IMGRX_TYPE_START			'S'			//payload word 0: destination address, word 1: number of data frames, word 2: byte order (NVM_BYTE_ORDER_)
+#define IMGRX_TYPE_DATA				'D'			//payload: the next half page of the image
+#define IMGRX_TYPE_END				'E'			//payload word 0: image length in words, word 1: CRC of the image
+
+#define IMGRX_ACK					0x06		//reply: ACK/NAK, then the sequence number expected next (LSB first)
+#define IMGRX_NAK					0x15
+
+#define IMGRX_IDLE					0
+#define IMGRX_RECEIVING				1
+#define IMGRX_DONE					2
+#define IMGRX_FAILED				3
+
+//LOCAL VARIABLE
+typedef struct {
+	volatile uint8_t state;						//IMGRX_ states
+	volatile uint8_t resync;					//1 while we wait for an idle line to restart the reception
+	uint16_t next_seq;							//sequence number of the frame we expect
+	uint16_t chunk_cnt;							//number of data frames announced by the start frame
+	uint8_t byte_order;							//NVM_BYTE_ORDER_ of the image
+	uint32_t dst_base;							//where the image goes, half page aligned
+	uint32_t frame_err_cnt;						//frames dropped because of a bad CRC or framing
+} ImageRX_TypeDef;
+
+//EXTERNAL VARIABLE
+extern ImageRX_TypeDef ImageRX;
+
+//FUNCTION PROTOTYPES
+void ImageRXInit(void);
+void ImageRX_Restart(void);
+
+#endif /* INC_IMAGERX_STM32L0x3_H_ */
@@ -0,0 +1,442 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.4
+ *  File: KVStore_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a log-structured key/value store.
+ * The KV_STORE area is used as a ring of pages. Each page starts with a header of two words: a sequence number and a magic word. The rest of the page holds records of two words: the value and then a header with the key.
+ * A new value for a key is simply appended to the head page with two word writes. Since the erased FLASH is 0 on L0xx, this never requires an erase.
+ * When the ring is full, the oldest page is compacted: its records that are still the latest ones for their key are copied to the head, then the page is erased.
+ * Since the pages are used one after the other around the ring, the erases are spread evenly over the whole area.
+ * A RAM index holds the address of the latest value of each key, so a read is a single lookup.
+ *
+ * v.1.1
+ * The RAM index is now a small open addressing hash table, sized at build time (KV_INDEX_SLOTS), so keys are not limited to a small range anymore.
+ * At boot, the index is rebuilt in one sequential pass over the ring, starting from the oldest page. No sorting is needed since the pages are used in ring order.
+ * Added a checkpoint: KV_Checkpoint saves the index into the last page of the KV_STORE area. After a clean shutdown, KV_Init restores the index from that one page instead of reading every record.
+ * The checkpoint is invalidated with a single word write at the first KV_Write after it, so it can never be older than the log.
+ *
+ * v.1.2
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.3
+ * KV_Append, KV_AdvanceHead and KV_Collect return the NVM status and KV_Write returns 0 on a failed write. The index, the head and the tail only move once their FLASH writes went through.
+ *
+ * v.1.4
+ * KV_Write doesn't append if the stale marker of the checkpoint can't be written. KV_Checkpoint only marks the checkpoint as live once the whole page was written, a failed one is marked stale right away.
+ *
+ */
+
+#include "KVStore_STM32L0x3.h"
+
+//Key/value store state
+KVStore_TypeDef KV_store = {0};
+
+
+//0)Local helpers
+static uint32_t KV_PageAddr(uint8_t page) {
+	return (uint32_t)&__kv_store_start__ + ((uint32_t)page * NVM_CFG_PAGE_BYTES);
+}
+
+static uint32_t* KV_SlotPtr(uint8_t page, uint8_t slot) {
+	return (uint32_t*)(KV_PageAddr(page) + 8 + ((uint32_t)slot * 8));
+}
+
+static uint32_t* KV_CheckpointPtr(void) {
+	return (uint32_t*)KV_PageAddr(KV_AREA_PAGE_CNT - 1);
+}
+
+static uint32_t KV_RecordHeader(uint16_t key, uint32_t value) {
+	/**
+	 * The record header is the KV_RECORD_MARK, the key and an 8-bit checksum of the key and the value.
+	 * The header is written after the value, so a record with a valid header always has a complete value. A record that was cut by a power loss fails the checksum.
+	 **/
+
+	uint8_t checksum = 0x5A ^ (uint8_t)key ^ (uint8_t)(key >> 8) ^ (uint8_t)value ^ (uint8_t)(value >> 8) ^ (uint8_t)(value >> 16) ^ (uint8_t)(value >> 24);
+	return ((uint32_t)KV_RECORD_MARK << 24) | ((uint32_t)key << 8) | checksum;
+}
+
+static uint8_t KV_RecordValid(uint32_t* record_ptr) {
+	uint32_t header = record_ptr[1];
+	uint16_t key = (uint16_t)(header >> 8);
+	if((header >> 24) != KV_RECORD_MARK) return 0;
+	if(key == 0) return 0;
+	return (header == KV_RecordHeader(key, record_ptr[0]));
+}
+
+static KV_IndexEntry_TypeDef* KV_IndexFind(uint16_t key) {
+	/**
+	 * Returns the index slot of the key, or the empty slot where the key would go.
+	 * Linear probing. The table is never full, since KV_INDEX_SLOTS is above KV_MAX_KEYS.
+	 **/
+
+	uint8_t slot = (uint8_t)(((uint32_t)key * 2654435761u) >> (32 - KV_INDEX_BITS));
+												//Note: multiplicative hash, the M0+ has a single cycle multiplier
+
+	while((KV_store.index[slot].key != 0) && (KV_store.index[slot].key != key)) {
+		slot = (slot + 1) & (KV_INDEX_SLOTS - 1);
+	}
+
+	return &KV_store.index[slot];
+}
+
+static uint8_t KV_IndexSet(uint16_t key, uint32_t* record_ptr) {
+	KV_IndexEntry_TypeDef* entry = KV_IndexFind(key);
+	if(entry->key == 0) {
+		if(KV_store.key_cnt == KV_MAX_KEYS) return 0;
+		entry->key = key;
+		KV_store.key_cnt++;
+	}
+	entry->offset = (uint16_t)((uint32_t)record_ptr - (uint32_t)&__kv_store_start__);
+	return 1;
+}
+
+static uint32_t* KV_IndexGet(uint16_t key) {
+	KV_IndexEntry_TypeDef* entry = KV_IndexFind(key);
+	if(entry->key == 0) return 0;
+	return (uint32_t*)((uint32_t)&__kv_store_start__ + entry->offset);
+}
+
+static uint32_t KV_CheckpointSum(uint32_t* words, uint8_t word_cnt) {
+	uint32_t sum = KV_CKPT_MAGIC;
+	for(uint8_t i = 0; i < word_cnt; i++) {
+		sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+	}
+	return sum;
+}
+
+static uint8_t KV_MarkStale(void) {
+	/**
+	 * Invalidates the checkpoint page with a single word write. A stale marker that is already set (or was left non-blank by a failed checkpoint) is not written again.
+	 **/
+
+	uint32_t* stale_ptr = &KV_CheckpointPtr()[KV_CKPT_STALE_WORD];
+
+	if(*stale_ptr != 0) return NVM_OK;
+	return FLASHUpd_Word((uint32_t)stale_ptr, 1);
+}
+
+static uint8_t KV_Append(uint16_t key, uint32_t value) {
+	/**
+	 * Writes a record into the next slot of the head page and points the index to it. There must be a free slot.
+	 * Returns NVM_OK or the NVM_ERR_ code of the failed write. The index is only changed once the record is complete.
+	 *
+	 * Note: a failed record is not valid, so the index keeps the previous value. Its slot is skipped if it isn't blank anymore, the same way KV_Init skips it.
+	 **/
+
+	uint32_t* record_ptr = KV_SlotPtr(KV_store.head_page, KV_store.head_slot);
+	uint8_t status;
+
+	status = FLASHUpd_Word((uint32_t)&record_ptr[0], value);
+	if(status == NVM_OK) status = FLASHUpd_Word((uint32_t)&record_ptr[1], KV_RecordHeader(key, value));
+
+	if(status == NVM_OK) {
+		KV_IndexSet(key, record_ptr);
+		KV_store.head_slot++;
+	} else if((record_ptr[0] != 0) || (record_ptr[1] != 0)) {
+		KV_store.head_slot++;
+	}
+
+	return status;
+}
+
+static uint8_t KV_AdvanceHead(void) {
+	/**
+	 * Moves the head to the next page of the ring. The page is erased if it isn't blank already, then we write its header.
+	 * The magic is written last, so a page is only considered part of the store once its header is complete.
+	 * Returns NVM_OK or the NVM_ERR_ code of the failed erase/write. The head stays where it was on a failure, so the next call starts over on the same page.
+	 **/
+
+	uint8_t next_page = (KV_store.head_page + 1) % KV_PAGE_CNT;
+	uint32_t next_page_addr = KV_PageAddr(next_page);
+	uint8_t status = NVM_OK;
+
+	if(FLASHPage_IsBlank(next_page_addr) == 0) status = FLASHErase_Page(next_page_addr);
+
+	if(status == NVM_OK) status = FLASHUpd_Word(next_page_addr, KV_store.head_seq + 1);
+	if(status == NVM_OK) status = FLASHUpd_Word(next_page_addr + 4, KV_PAGE_MAGIC);
+	if(status != NVM_OK) return status;
+
+	KV_store.head_seq++;
+	KV_store.head_page = next_page;
+	KV_store.head_slot = 0;
+	KV_store.used_page_cnt++;
+
+	return NVM_OK;
+}
+
+static uint8_t KV_Collect(void) {
+	/**
+	 * Garbage collection. The oldest page of the ring is compacted into the head and then erased.
+	 *
+	 * 1)Copy the records of the tail page that are still referenced by the index
+	 * 2)Erase the tail page and step the tail
+	 *
+	 * Returns NVM_OK or the NVM_ERR_ code of the failed erase/write.
+	 *
+	 * Note: the head may need to step into the spare page while we copy. This is why we always keep a spare page around before the collection starts.
+	 * Note: the tail is only erased once all its live records are copied. A failed copy leaves it as it is, with the index still pointing into it.
+	 **/
+
+	uint8_t status = NVM_OK;
+
+	//1)
+	for(uint8_t slot = 0; slot < KV_RECORDS_PER_PAGE; slot++) {
+		uint32_t* record_ptr = KV_SlotPtr(KV_store.tail_page, slot);
+		if(KV_RecordValid(record_ptr) == 0) continue;
+		uint16_t key = (uint16_t)(record_ptr[1] >> 8);
+		if(KV_IndexGet(key) != record_ptr) continue;		//an older value, dropped
+		if(KV_store.head_slot == KV_RECORDS_PER_PAGE) status = KV_AdvanceHead();
+		if(status == NVM_OK) status = KV_Append(key, record_ptr[0]);
+		if(status != NVM_OK) return status;
+	}
+
+	//2)
+	status = FLASHErase_Page(KV_PageAddr(KV_store.tail_page));
+	if(status != NVM_OK) return status;
+
+	KV_store.tail_page = (KV_store.tail_page + 1) % KV_PAGE_CNT;
+	KV_store.used_page_cnt--;
+
+	return NVM_OK;
+}
+
+static uint8_t KV_Restore(void) {
+	/**
+	 * Restores the index and the ring state from the checkpoint page, if it is valid and not stale.
+	 *
+	 * Layout of the checkpoint page:
+	 * word 0: KV_CKPT_MAGIC
+	 * word 1: head page, tail page, head slot and used page count (one byte each)
+	 * word 2: head sequence number
+	 * word 3: number of entries
+	 * word 4: checksum of words 1 to 3 and the entries
+	 * word 5 to 30: entries, key in the upper half, offset in the lower half
+	 * word 31: stale marker, 0 while the checkpoint is valid
+	 **/
+
+	uint32_t* ckpt_ptr = KV_CheckpointPtr();
+	uint32_t entry_cnt = ckpt_ptr[3];
+
+	if((ckpt_ptr[0] != KV_CKPT_MAGIC) || (ckpt_ptr[KV_CKPT_STALE_WORD] != 0)) return 0;
+	if(entry_cnt > KV_MAX_KEYS) return 0;
+	if(ckpt_ptr[4] != (KV_CheckpointSum(&ckpt_ptr[1], 3) ^ KV_CheckpointSum(&ckpt_ptr[5], (uint8_t)entry_cnt))) return 0;
+
+	KV_store.head_page = (uint8_t)(ckpt_ptr[1] >> 24);
+	KV_store.tail_page = (uint8_t)(ckpt_ptr[1] >> 16);
+	KV_store.head_slot = (uint8_t)(ckpt_ptr[1] >> 8);
+	KV_store.used_page_cnt = (uint8_t)ckpt_ptr[1];
+	KV_store.head_seq = ckpt_ptr[2];
+
+	for(uint8_t i = 0; i < entry_cnt; i++) {
+		KV_IndexSet((uint16_t)(ckpt_ptr[5 + i] >> 16), (uint32_t*)((uint32_t)&__kv_store_start__ + (ckpt_ptr[5 + i] & 0xFFFF)));
+	}
+
+	KV_store.checkpoint_live = 1;
+
+	return 1;
+}
+
+
+//1)Initialise the store
+uint8_t KV_Init(void) {
+	/**
+	 * Rebuilds the RAM index. Must be called once at startup before any read or write.
+	 *
+	 * 1)Check the KV_STORE area against the linker file and clear the index
+	 * 2)Restore from the checkpoint if we had a clean shutdown
+	 * 3)Otherwise, read the page headers to find the oldest page (tail) and the newest one (head)
+	 * 4)Replay the records in one pass around the ring, from the tail to the head, so the newest value of each key ends up in the index
+	 * 5)Find the first free slot of the head page
+	 * 6)Start a new store if there was no page in use
+	 *
+	 * Returns 1 on success, 0 if the area does not match KV_AREA_PAGE_CNT or the first page of a new store could not be written.
+	 **/
+
+	uint8_t used_cnt = 0;
+	uint8_t tail_page = 0;
+	uint8_t head_page = 0;
+
+	//1)
+	if(((uint32_t)&__kv_store_end__ - (uint32_t)&__kv_store_start__) != (KV_AREA_PAGE_CNT * NVM_CFG_PAGE_BYTES)) return 0;
+
+	for(uint8_t i = 0; i < KV_INDEX_SLOTS; i++) KV_store.index[i].key = 0;
+	KV_store.key_cnt = 0;
+	KV_store.checkpoint_live = 0;
+
+	//2)
+	if(KV_Restore() == 1) return 1;
+
+	for(uint8_t i = 0; i < KV_INDEX_SLOTS; i++) KV_store.index[i].key = 0;
+	KV_store.key_cnt = 0;						//a checkpoint that failed half way may have left entries behind
+
+	//3)
+	for(uint8_t page = 0; page < KV_PAGE_CNT; page++) {
+		uint32_t* page_ptr = (uint32_t*)KV_PageAddr(page);
+		if((page_ptr[1] != KV_PAGE_MAGIC) || (page_ptr[0] == 0)) continue;
+		if((used_cnt == 0) || (page_ptr[0] < ((uint32_t*)KV_PageAddr(tail_page))[0])) tail_page = page;
+		if((used_cnt == 0) || (page_ptr[0] > ((uint32_t*)KV_PageAddr(head_page))[0])) head_page = page;
+		used_cnt++;
+	}
+
+	if(used_cnt != 0) {
+		//4)
+		for(uint8_t i = 0; i < used_cnt; i++) {
+			uint8_t page = (tail_page + i) % KV_PAGE_CNT;
+			if(((uint32_t*)KV_PageAddr(page))[1] != KV_PAGE_MAGIC) continue;
+			for(uint8_t slot = 0; slot < KV_RECORDS_PER_PAGE; slot++) {
+				uint32_t* record_ptr = KV_SlotPtr(page, slot);
+				if(KV_RecordValid(record_ptr) == 1) KV_IndexSet((uint16_t)(record_ptr[1] >> 8), record_ptr);
+			}
+		}
+
+		//5)
+		KV_store.tail_page = tail_page;
+		KV_store.head_page = head_page;
+		KV_store.head_seq = ((uint32_t*)KV_PageAddr(head_page))[0];
+		KV_store.used_page_cnt = used_cnt;
+		KV_store.head_slot = 0;
+		for(uint8_t slot = 0; slot < KV_RECORDS_PER_PAGE; slot++) {
+			uint32_t* record_ptr = KV_SlotPtr(head_page, slot);
+			if((record_ptr[0] != 0) || (record_ptr[1] != 0)) KV_store.head_slot = slot + 1;
+												//Note: a slot cut by a power loss is not valid, but it is not blank either, so we skip it
+		}
+	} else {
+		//6)
+		NVM_SessionBegin();
+		KV_store.head_page = KV_PAGE_CNT - 1;	//KV_AdvanceHead steps to page 0
+		KV_store.head_seq = 0;
+		KV_store.used_page_cnt = 0;
+		if(KV_AdvanceHead() != NVM_OK) {
+			NVM_SessionEnd();
+			return 0;
+		}
+		KV_store.tail_page = KV_store.head_page;
+		NVM_SessionEnd();
+	}
+
+	return 1;
+}
+
+
+//2)Read a key
+uint8_t KV_Read(uint16_t key, uint32_t* value) {
+	/**
+	 * Returns 1 and the latest value of the key, or 0 if the key is not stored.
+	 * The value is read directly from the FLASH through the RAM index.
+	 **/
+
+	uint32_t* record_ptr;
+
+	if(key == 0) return 0;
+	record_ptr = KV_IndexGet(key);
+	if(record_ptr == 0) return 0;
+
+	*value = *record_ptr;
+	return 1;
+}
+
+
+//3)Write a key
+uint8_t KV_Write(uint16_t key, uint32_t value) {
+	/**
+	 * Appends a new value for the key. If the value is the same as the stored one, nothing is written.
+	 *
+	 * 1)Check the key and the current value
+	 * 2)Invalidate the checkpoint, it won't match the FLASH anymore after this write
+	 * 3)Make room: step the head to the next page, or run the garbage collection if only the spare page is left
+	 * 4)Append the record
+	 *
+	 * Returns 1 on success, 0 if the key is 0, the store already holds KV_MAX_KEYS other keys, the checkpoint could not be invalidated or a FLASH erase/write failed.
+	 * The index keeps the previous value of the key on a failure.
+	 **/
+
+	uint32_t current_value;
+	uint8_t status = NVM_OK;
+
+	//1)
+	if(key == 0) return 0;
+	if(KV_Read(key, &current_value) == 1) {
+		if(current_value == value) return 1;
+	} else if(KV_store.key_cnt == KV_MAX_KEYS) {
+		return 0;
+	}
+
+	NVM_SessionBegin();
+
+	//2)
+	if(KV_store.checkpoint_live == 1) {
+		if(KV_MarkStale() != NVM_OK) {
+			NVM_SessionEnd();
+			return 0;
+		}										//a record appended behind a valid checkpoint would be lost by the next KV_Restore
+		KV_store.checkpoint_live = 0;
+	}
+
+	//3)
+	while((status == NVM_OK) && (KV_store.head_slot == KV_RECORDS_PER_PAGE)) {
+		if(KV_store.used_page_cnt < (KV_PAGE_CNT - 1)) {
+			status = KV_AdvanceHead();
+		} else {
+			status = KV_Collect();
+		}
+	}
+
+	//4)
+	if(status == NVM_OK) status = KV_Append(key, value);
+
+	NVM_SessionEnd();
+
+	return (status == NVM_OK) ? 1 : 0;
+}
+
+
+//4)Save a checkpoint of the index
+void KV_Checkpoint(void) {
+	/**
+	 * Saves the index and the ring state into the checkpoint page, so the next KV_Init doesn't need to scan the log.
+	 * Call it before a clean shutdown. It costs one page erase and two half-page writes.
+	 * If nothing was written since the last checkpoint, nothing is done.
+	 *
+	 * 1)Build the page in RAM
+	 * 2)Erase the checkpoint page and write it
+	 *
+	 * Note: the checkpoint only counts as live once every word of it was written. A failed one is marked stale right away, since a page with few entries can pass its checksum with only the first half written.
+	 **/
+
+	uint32_t ckpt_buf [NVM_CFG_PAGE_WORDS] = {0};
+	uint8_t entry_cnt = 0;
+	uint8_t status;
+
+	if(KV_store.checkpoint_live == 1) return;
+
+	//1)
+	for(uint8_t i = 0; i < KV_INDEX_SLOTS; i++) {
+		if(KV_store.index[i].key == 0) continue;
+		ckpt_buf[5 + entry_cnt++] = ((uint32_t)KV_store.index[i].key << 16) | KV_store.index[i].offset;
+	}
+
+	ckpt_buf[0] = KV_CKPT_MAGIC;
+	ckpt_buf[1] = ((uint32_t)KV_store.head_page << 24) | ((uint32_t)KV_store.tail_page << 16) | ((uint32_t)KV_store.head_slot << 8) | KV_store.used_page_cnt;
+	ckpt_buf[2] = KV_store.head_seq;
+	ckpt_buf[3] = entry_cnt;
+	ckpt_buf[4] = KV_CheckpointSum(&ckpt_buf[1], 3) ^ KV_CheckpointSum(&ckpt_buf[5], entry_cnt);
+	ckpt_buf[KV_CKPT_STALE_WORD] = 0;							//stale marker stays blank, so it can be written later without an erase
+
+	//2)
+	NVM_SessionBegin();
+	status = FLASHErase_Page((uint32_t)KV_CheckpointPtr());
+	if(status == NVM_OK) status = FLASHUpd_HalfPageStream(ckpt_buf, (uint32_t)KV_CheckpointPtr(), NVM_CFG_PAGE_WORDS);
+
+	if(status == NVM_OK) {
+		KV_store.checkpoint_live = 1;
+	} else if(KV_MarkStale() != NVM_OK) {
+		KV_store.checkpoint_live = 1;			//it may still pass KV_Restore, so the next KV_Write must not append before it has marked it stale
+	}
+	NVM_SessionEnd();
+}
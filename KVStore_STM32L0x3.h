@@ -0,0 +1,68 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.2
+ *  File: KVStore_STM32L0x3.h
+ *
+ *      This is a log-structured key/value store in the KV_STORE memory area of the FLASH.
+ *      Records are only ever appended, so a write never needs an erase. Pages are erased one at a time by the garbage collection.
+ */
+
+#ifndef INC_KVSTORE_STM32L0x3_H_
+#define INC_KVSTORE_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define KV_AREA_PAGE_CNT			16			//pages in the KV_STORE area (2 kbytes)
+#define KV_PAGE_CNT					15			//pages of the log, the last page of the area is the checkpoint
+#define KV_RECORDS_PER_PAGE			((NVM_CFG_PAGE_WORDS - 2) / 2)	//2 words of page header, then 15 records of 2 words
+#define KV_MAX_KEYS					24			//number of different keys the store can hold, keys can go from 1 to 0xFFFF
+
+#define KV_INDEX_BITS				5
+#define KV_INDEX_SLOTS				(1 << KV_INDEX_BITS)	//hash index slots, must be a power of 2 and above KV_MAX_KEYS
+#define KV_INDEX_RAM_BUDGET			256			//bytes of RAM we allow for the index
+
+#define KV_PAGE_MAGIC				0x4B565354	//"KVST", marks a page that belongs to the store
+#define KV_RECORD_MARK				0xA5		//top byte of a record header
+#define KV_CKPT_MAGIC				0x4B56434B	//"KVCK", marks a checkpoint page
+#define KV_CKPT_STALE_WORD			(NVM_CFG_PAGE_WORDS - 1)	//last word of the checkpoint page, the stale marker
+#define KV_CKPT_MAX_ENTRIES			26			//index entries that fit into the checkpoint page
+
+//LOCAL VARIABLE
+typedef struct {
+	uint16_t key;								//0 if the slot is empty
+	uint16_t offset;							//byte offset of the record from the start of the KV_STORE area
+} KV_IndexEntry_TypeDef;
+
+typedef struct {
+	KV_IndexEntry_TypeDef index [KV_INDEX_SLOTS];	//hash index of the latest record of each key
+	uint8_t key_cnt;							//keys in the index
+	uint8_t checkpoint_live;					//1 if the checkpoint page matches the FLASH and must be invalidated before the next write
+	uint8_t head_page;							//page we are appending to
+	uint8_t head_slot;							//next free record slot in the head page
+	uint8_t tail_page;							//oldest page in use
+	uint8_t used_page_cnt;						//pages in use, from tail to head
+	uint32_t head_seq;							//sequence number of the head page
+} KVStore_TypeDef;
+
+_Static_assert((KV_INDEX_SLOTS > KV_MAX_KEYS) && (sizeof(KV_IndexEntry_TypeDef) * KV_INDEX_SLOTS <= KV_INDEX_RAM_BUDGET), "KV index does not fit its RAM budget");
+_Static_assert(KV_MAX_KEYS <= KV_CKPT_MAX_ENTRIES, "KV index does not fit into the checkpoint page");
+
+//EXTERNAL VARIABLE
+extern KVStore_TypeDef KV_store;
+extern uint32_t __kv_store_start__;
+extern uint32_t __kv_store_end__;
+
+//FUNCTION PROTOTYPES
+uint8_t KV_Init(void);
+uint8_t KV_Read(uint16_t key, uint32_t* value);
+uint8_t KV_Write(uint16_t key, uint32_t value);
+void KV_Checkpoint(void);
+
+#endif /* INC_KVSTORE_STM32L0x3_H_ */
@@ -0,0 +1,203 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.1
+ *  File: NVMBench_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a benchmark for the NVM primitives.
+ * Each primitive is run NVMBENCH_ITERATIONS times at every MSI range and timed with NVM_GetCycles (SysTick based, since the M0+ has no DWT cycle counter).
+ * The erases needed before the writes are done outside the timed part.
+ * The slot B area is used as a scratch area, so the benchmark can't be combined with an actual update in slot B. Every run costs about 30 erases per range on the first two pages of slot B, which is well within the endurance of the FLASH.
+ * Since USART2 can't run at 115200 baud from the lower MSI ranges, the results of a range are printed after we went back to the default range.
+ *
+ * v.1.1
+ * The page geometry comes from NVMConfig.
+ *
+ */
+
+#include "NVMBench_STM32L0x3.h"
+#include "main.h"
+#include "stdio.h"
+
+//Results of the range being measured
+NVMBench_Result_TypeDef NVMBench_results[NVMBENCH_OP_CNT];
+
+//Scratch source for the stream and the DMA writes
+static uint32_t NVMBench_src_buf [NVM_CFG_PAGE_WORDS];
+
+static const char* const NVMBench_op_names[NVMBENCH_OP_CNT] = {
+	"erase page        ",
+	"word              ",
+	"16 x word         ",
+	"half page         ",
+	"half page DMA     ",
+	"stream page       ",
+	"erase range 2 pg  ",
+	"delta no change   "
+};
+
+static const uint32_t NVMBench_msi_ranges[NVMBENCH_MSI_RANGE_CNT] = {
+	RCC_MSIRANGE_0, RCC_MSIRANGE_1, RCC_MSIRANGE_2, RCC_MSIRANGE_3, RCC_MSIRANGE_4, RCC_MSIRANGE_5, RCC_MSIRANGE_6
+};
+
+
+//0)Local helpers
+static uint32_t NVMBench_ScratchAddr(void) {
+	return (uint32_t)&__app_slot_b_start__;		//the first two pages of slot B
+}
+
+static void NVMBench_SetMSI(uint32_t msi_range) {
+	/**
+	 * Same settings as SystemClock_Config, only the MSI range changes.
+	 * HAL_RCC_ClockConfig also updates SystemCoreClock and the SysTick reload value, so HAL_Delay and NVM_GetCycles stay consistent.
+	 **/
+
+	RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+	RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+	RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_MSI;
+	RCC_OscInitStruct.MSIState = RCC_MSI_ON;
+	RCC_OscInitStruct.MSICalibrationValue = 0;
+	RCC_OscInitStruct.MSIClockRange = msi_range;
+	RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+	if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) Error_Handler();
+
+	RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+	                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+	RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_MSI;
+	RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
+	RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK) Error_Handler();
+}
+
+static void NVMBench_Log(uint8_t op, uint32_t start_cycles) {
+	uint32_t cycles = NVM_GetCycles() - start_cycles;
+
+	if(cycles < NVMBench_results[op].min_cycles) NVMBench_results[op].min_cycles = cycles;
+	if(cycles > NVMBench_results[op].max_cycles) NVMBench_results[op].max_cycles = cycles;
+	NVMBench_results[op].sum_cycles += cycles;
+	NVMBench_results[op].run_cnt++;
+}
+
+
+//1)Measure all primitives at the current clock
+static void NVMBench_Measure(void) {
+	/**
+	 * 1)Reset the results
+	 * 2)Run each primitive, erasing the scratch area (untimed) where it is needed
+	 *
+	 * Note: FLASHUpd_HalfPage writes Data_buf, the rest use NVMBench_src_buf.
+	 **/
+
+	uint32_t scratch_addr = NVMBench_ScratchAddr();
+	uint32_t start_cycles;
+
+	//1)
+	for(uint8_t op = 0; op < NVMBENCH_OP_CNT; op++) {
+		NVMBench_results[op].min_cycles = 0xFFFFFFFF;
+		NVMBench_results[op].max_cycles = 0;
+		NVMBench_results[op].sum_cycles = 0;
+		NVMBench_results[op].run_cnt = 0;
+	}
+
+	//2)
+	for(uint8_t i = 0; i < NVMBENCH_ITERATIONS; i++) {
+
+		FLASHUpd_Word(scratch_addr, 0xA5A5A5A5);	//we make sure the page is not blank, so the erase has something to do
+		start_cycles = NVM_GetCycles();
+		FLASHErase_Page(scratch_addr);
+		NVMBench_Log(NVMBENCH_OP_ERASE_PAGE, start_cycles);
+
+		start_cycles = NVM_GetCycles();
+		FLASHUpd_Word(scratch_addr, 0xA5A5A5A5);
+		NVMBench_Log(NVMBENCH_OP_WORD, start_cycles);
+
+		FLASHErase_Page(scratch_addr);
+		start_cycles = NVM_GetCycles();
+		for(uint8_t j = 0; j < NVM_CFG_HALF_PAGE_WORDS; j++) {
+			FLASHUpd_Word(scratch_addr + (j * 4), NVMBench_src_buf[j]);
+		}
+		NVMBench_Log(NVMBENCH_OP_WORD_X16, start_cycles);
+
+		FLASHErase_Page(scratch_addr);
+		start_cycles = NVM_GetCycles();
+		FLASHUpd_HalfPage(scratch_addr);
+		NVMBench_Log(NVMBENCH_OP_HALF_PAGE, start_cycles);
+
+		FLASHErase_Page(scratch_addr);
+		start_cycles = NVM_GetCycles();
+		FLASHUpd_HalfPageDMA(NVMBench_src_buf, scratch_addr, 0);
+		NVMBench_Log(NVMBENCH_OP_HALF_PAGE_DMA, start_cycles);
+
+		FLASHErase_Page(scratch_addr);
+		start_cycles = NVM_GetCycles();
+		FLASHUpd_HalfPageStream(NVMBench_src_buf, scratch_addr, NVM_CFG_PAGE_WORDS);
+		NVMBench_Log(NVMBENCH_OP_STREAM_PAGE, start_cycles);
+
+		start_cycles = NVM_GetCycles();
+		FLASHUpd_Delta(NVMBench_src_buf, scratch_addr, NVM_CFG_PAGE_WORDS);	//the page already holds the same data, so this is only the compare
+		NVMBench_Log(NVMBENCH_OP_DELTA_NOCHANGE, start_cycles);
+
+		FLASHUpd_Word(scratch_addr + NVM_CFG_PAGE_BYTES, 0xA5A5A5A5);	//both pages are now in use
+		start_cycles = NVM_GetCycles();
+		FLASHErase_Range(scratch_addr, 2 * NVM_CFG_PAGE_BYTES);
+		NVMBench_Log(NVMBENCH_OP_ERASE_RANGE, start_cycles);
+	}
+}
+
+
+//2)Print the results of a range
+static void NVMBench_Print(uint8_t msi_range, uint32_t core_clock) {
+	printf("MSI range %d (%lu Hz), %d runs\r\n", msi_range, (unsigned long)core_clock, NVMBENCH_ITERATIONS);
+
+	for(uint8_t op = 0; op < NVMBENCH_OP_CNT; op++) {
+		printf("  %s min/avg/max: %lu / %lu / %lu cycles\r\n",
+				NVMBench_op_names[op],
+				(unsigned long)NVMBench_results[op].min_cycles,
+				(unsigned long)(NVMBench_results[op].sum_cycles / NVMBench_results[op].run_cnt),
+				(unsigned long)NVMBench_results[op].max_cycles);
+	}
+}
+
+
+//3)Run the benchmark
+void NVMBench_Run(void) {
+	/**
+	 * Alternative main loop of the "nvm_benchmark" build. Called once after the peripherals are initialised.
+	 *
+	 * 1)Fill the source buffer with a pattern
+	 * 2)For each MSI range: switch clocks, measure, go back to the default range and print
+	 * 3)Clean up the scratch area
+	 *
+	 * Note: cycles are core clock cycles. The time of an operation is cycles / core clock.
+	 * Note: the FLASH programming time itself is fixed (about 3.2 ms per erase or half page), so the lower the clock, the fewer cycles everything takes.
+	 **/
+
+	uint32_t core_clock;
+
+	//1)
+	for(uint8_t i = 0; i < NVM_CFG_PAGE_WORDS; i++) {
+		NVMBench_src_buf[i] = 0x01010101 * (i + 1);
+	}
+
+	printf("NVM benchmark\r\n");
+
+	//2)
+	for(uint8_t range = 0; range < NVMBENCH_MSI_RANGE_CNT; range++) {
+		NVMBench_SetMSI(NVMBench_msi_ranges[range]);
+		core_clock = SystemCoreClock;
+		NVMBench_Measure();
+		NVMBench_SetMSI(NVMBench_msi_ranges[NVMBENCH_MSI_RANGE_DEFAULT]);
+		NVMBench_Print(range, core_clock);
+	}
+
+	//3)
+	FLASHErase_Range(NVMBench_ScratchAddr(), 2 * NVM_CFG_PAGE_BYTES);
+
+	printf("NVM benchmark done\r\n");
+}
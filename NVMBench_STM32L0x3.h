@@ -0,0 +1,51 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: NVMBench_STM32L0x3.h
+ *
+ *      This is a benchmark for the NVM primitives. It is an alternative main loop, selected with the "nvm_benchmark" define.
+ *      Every primitive is timed in core clock cycles at each MSI range and the min/avg/max values are printed over USART2.
+ */
+
+#ifndef INC_NVMBENCH_STM32L0x3_H_
+#define INC_NVMBENCH_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+#include "APPSlot_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define NVMBENCH_ITERATIONS			8			//runs of each primitive per MSI range
+#define NVMBENCH_MSI_RANGE_CNT		7			//MSI range 0 (65 kHz) to 6 (4.2 MHz)
+#define NVMBENCH_MSI_RANGE_DEFAULT	5			//the range SystemClock_Config sets, the results are printed at this one
+
+#define NVMBENCH_OP_ERASE_PAGE		0
+#define NVMBENCH_OP_WORD			1
+#define NVMBENCH_OP_WORD_X16		2
+#define NVMBENCH_OP_HALF_PAGE		3
+#define NVMBENCH_OP_HALF_PAGE_DMA	4
+#define NVMBENCH_OP_STREAM_PAGE		5
+#define NVMBENCH_OP_ERASE_RANGE		6
+#define NVMBENCH_OP_DELTA_NOCHANGE	7
+#define NVMBENCH_OP_CNT				8
+
+//LOCAL VARIABLE
+typedef struct {
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint32_t sum_cycles;
+	uint32_t run_cnt;
+} NVMBench_Result_TypeDef;
+
+//EXTERNAL VARIABLE
+extern NVMBench_Result_TypeDef NVMBench_results[NVMBENCH_OP_CNT];
+
+//FUNCTION PROTOTYPES
+void NVMBench_Run(void);
+
+#endif /* INC_NVMBENCH_STM32L0x3_H_ */
@@ -0,0 +1,236 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.2
+ *  File: NVMCache_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a write-back cache in front of the NVM primitives.
+ * Writing the same word many times a second with FLASHUpd_Word costs a page erase for every write (the word is not blank anymore) and blocks the core on BSY each time.
+ * Here, a write only changes a half page copy in RAM. The copy is written into the FLASH once, as a half page burst:
+ * - NVM_CACHE_FLUSH_MS after its first change (NVMCache_Poll, called from the main loop),
+ * - when its line is needed for another half page and it is the least recently used (cache full),
+ * - on NVMCache_Sync.
+ * The page is only erased if a changed half page is not blank in the FLASH.
+ * Reads are served from the cache first, so they always see the latest value.
+ *
+ * Note: the cache holds the only copy of unflushed data. Anything that must survive a reset must be followed by NVMCache_Sync.
+ * Note: writes to the FLASH that bypass the cache must be preceded by NVMCache_Sync and followed by NVMCache_Invalidate.
+ *
+ * v.1.1
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.2
+ * A flush writes half page bursts (FLASHUpd_HalfPageStreamBank) instead of going through NVM_Write and the delta update. Both cached halves of a page are flushed together, so the page is erased at most once.
+ *
+ */
+
+#include "NVMCache_STM32L0x3.h"
+#include "main.h"
+
+//Cache lines and counters
+NVMCache_TypeDef NVM_cache = {0};
+
+
+//0)Local helpers
+static NVMCache_Line_TypeDef* NVMCache_Find(uint32_t half_page_addr) {
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		if(NVM_cache.line[i].base_addr == half_page_addr) return &NVM_cache.line[i];
+	}
+	return 0;
+}
+
+static uint8_t NVMCache_Flush(NVMCache_Line_TypeDef* line_ptr) {
+	/**
+	 * Writes a dirty line into the FLASH, together with the other line of the same page if that one is cached too. The lines stay valid and clean.
+	 *
+	 * 1)Merge the FLASH page and every cached line of it in RAM
+	 * 2)Check which half pages changed and if they can be written without an erase (the target half page is blank)
+	 * 3)Write the changed half pages as bursts, or erase the page once and write back every half page that isn't blank
+	 * 4)Mark the lines clean
+	 *
+	 * Note: both half pages of a page are flushed together, so a page is erased only once even if both of its halves were dirty.
+	 **/
+
+	uint32_t flash_page_addr = line_ptr->base_addr & ~(uint32_t)NVM_CFG_PAGE_MASK;
+	uint32_t page_buf [NVM_CFG_PAGE_WORDS];		//the source of the bursts must be in RAM
+	uint8_t changed_half_pages = 0;
+	uint8_t erase_needed = 0;
+	uint8_t status = NVM_OK;
+
+	if(line_ptr->dirty_mask == 0) return NVM_OK;
+
+	//1)
+	for(uint8_t i = 0; i < NVM_CFG_PAGE_WORDS; i++) {
+		page_buf[i] = *(__IO uint32_t*)(flash_page_addr + (i * 4));
+	}
+
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		if((NVM_cache.line[i].base_addr & ~(uint32_t)NVM_CFG_PAGE_MASK) == flash_page_addr) {
+			uint8_t h = (NVM_cache.line[i].base_addr & NVM_CFG_PAGE_MASK) / NVM_CFG_HALF_PAGE_BYTES;
+			for(uint8_t j = 0; j < NVM_CACHE_LINE_WORDS; j++) page_buf[(h * NVM_CFG_HALF_PAGE_WORDS) + j] = NVM_cache.line[i].data[j];
+		}
+	}
+
+	//2)
+	for(uint8_t h = 0; h < 2; h++) {
+		uint32_t flash_half_page_addr = flash_page_addr + (h * NVM_CFG_HALF_PAGE_BYTES);
+		if(NVM_WordCompare(&page_buf[h * NVM_CFG_HALF_PAGE_WORDS], (const uint32_t*)flash_half_page_addr, NVM_CFG_HALF_PAGE_WORDS) == NVM_CFG_HALF_PAGE_WORDS) continue;
+		changed_half_pages |= (1 << h);
+		if(FLASHRegion_IsBlank(flash_half_page_addr, NVM_CFG_HALF_PAGE_WORDS) == 0) erase_needed = 1;
+	}											//Note: a half page burst rewrites all 16 words, so it needs the whole half page blank
+
+	//3)
+	NVM_SessionBegin();							//one unlock for the erase and the bursts
+
+	if(erase_needed == 1) {
+		status = FLASHErase_Page(flash_page_addr);
+		changed_half_pages = 0;
+		for(uint8_t h = 0; h < 2; h++) {
+			if(NVM_WordScan(&page_buf[h * NVM_CFG_HALF_PAGE_WORDS], NVM_CFG_HALF_PAGE_WORDS, 0) != NVM_CFG_HALF_PAGE_WORDS) changed_half_pages |= (1 << h);
+		}										//after the erase, only the half pages that aren't blank in the buffer are written back
+	}
+
+	for(uint8_t h = 0; (h < 2) && (status == NVM_OK); h++) {
+		if((changed_half_pages & (1 << h)) == 0) continue;
+		status = FLASHUpd_HalfPageStreamBank(&page_buf[h * NVM_CFG_HALF_PAGE_WORDS], flash_page_addr + (h * NVM_CFG_HALF_PAGE_BYTES), NVM_CFG_HALF_PAGE_WORDS);
+		if(status == NVM_OK) NVM_cache.flush_cnt++;
+	}
+
+	NVM_SessionEnd();
+
+	//4)
+	if(status == NVM_OK) {
+		for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+			if((NVM_cache.line[i].base_addr & ~(uint32_t)NVM_CFG_PAGE_MASK) == flash_page_addr) NVM_cache.line[i].dirty_mask = 0;
+		}
+	}											//Note: lines that failed to flush stay dirty and are tried again
+	NVM_cache.last_status = status;
+
+	return status;
+}
+
+static NVMCache_Line_TypeDef* NVMCache_Alloc(uint32_t half_page_addr) {
+	/**
+	 * Picks a free line, or the least recently used one which is flushed first, and loads the half page into it.
+	 * Returns 0 if the victim couldn't be flushed.
+	 **/
+
+	NVMCache_Line_TypeDef* line_ptr = &NVM_cache.line[0];
+
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		if(NVM_cache.line[i].base_addr == 0) {
+			line_ptr = &NVM_cache.line[i];
+			break;
+		}
+		if((HAL_GetTick() - NVM_cache.line[i].use_tick) > (HAL_GetTick() - line_ptr->use_tick)) line_ptr = &NVM_cache.line[i];
+	}
+
+	if(NVMCache_Flush(line_ptr) != NVM_OK) return 0;
+
+	line_ptr->base_addr = half_page_addr;
+	for(uint8_t i = 0; i < NVM_CACHE_LINE_WORDS; i++) {
+		line_ptr->data[i] = *(__IO uint32_t*)(half_page_addr + (i * 4));
+	}
+
+	return line_ptr;
+}
+
+
+//1)Write a word through the cache
+uint8_t NVMCache_Write(uint32_t flash_addr, uint32_t value) {
+	/**
+	 * 1)Find the line of the half page, or load it
+	 * 2)Update the word and mark it dirty. A word that is written with its current value is left clean.
+	 *
+	 * Returns NVM_OK, NVM_ERR_RANGE/NVM_ERR_PGA for a bad address, or the error of the flush that was needed to free a line.
+	 **/
+
+	uint32_t half_page_addr = flash_addr & ~(uint32_t)NVM_CFG_HALF_PAGE_MASK;
+	uint8_t word = (flash_addr & NVM_CFG_HALF_PAGE_MASK) >> 2;
+	NVMCache_Line_TypeDef* line_ptr;
+
+	if(NVM_BackendOf(flash_addr) != NVM_BACKEND_FLASH) return NVM_ERR_RANGE;
+	if((flash_addr & 0x3) != 0) return NVM_ERR_PGA;
+
+	//1)
+	line_ptr = NVMCache_Find(half_page_addr);
+	if(line_ptr == 0) line_ptr = NVMCache_Alloc(half_page_addr);
+	if(line_ptr == 0) return NVM_cache.last_status;
+
+	//2)
+	NVM_cache.write_cnt++;
+	line_ptr->use_tick = HAL_GetTick();
+	if(line_ptr->data[word] == value) return NVM_OK;
+
+	if((line_ptr->dirty_mask & (1<<word)) != 0) NVM_cache.merge_cnt++;
+	if(line_ptr->dirty_mask == 0) line_ptr->dirty_tick = HAL_GetTick();
+	line_ptr->data[word] = value;
+	line_ptr->dirty_mask |= (1<<word);
+
+	return NVM_OK;
+}
+
+
+//2)Read a word through the cache
+uint32_t NVMCache_Read(uint32_t flash_addr) {
+	/**
+	 * A word of a cached half page is read from RAM, anything else from the FLASH. A miss doesn't load a line.
+	 **/
+
+	NVMCache_Line_TypeDef* line_ptr = NVMCache_Find(flash_addr & ~(uint32_t)NVM_CFG_HALF_PAGE_MASK);
+
+	if(line_ptr != 0) {
+		line_ptr->use_tick = HAL_GetTick();
+		return line_ptr->data[(flash_addr & NVM_CFG_HALF_PAGE_MASK) >> 2];
+	}
+
+	return *(__IO uint32_t*)(flash_addr & ~0x3);
+}
+
+
+//3)Flush every dirty line
+uint8_t NVMCache_Sync(void) {
+	/**
+	 * Returns NVM_OK if every line is clean, the first flush error otherwise.
+	 **/
+
+	uint8_t status = NVM_OK;
+	uint8_t line_status;
+
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		line_status = NVMCache_Flush(&NVM_cache.line[i]);
+		if(status == NVM_OK) status = line_status;
+	}
+
+	return status;
+}
+
+
+//4)Timed flush
+void NVMCache_Poll(void) {
+	/**
+	 * To be called from the main loop. Flushes the lines that have been dirty for NVM_CACHE_FLUSH_MS or longer.
+	 **/
+
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		if((NVM_cache.line[i].dirty_mask != 0) && ((HAL_GetTick() - NVM_cache.line[i].dirty_tick) >= NVM_CACHE_FLUSH_MS)) {
+			NVMCache_Flush(&NVM_cache.line[i]);
+		}
+	}
+}
+
+
+//5)Drop every clean line
+void NVMCache_Invalidate(void) {
+	/**
+	 * Frees the clean lines, so the next access reads the FLASH again. Dirty lines are kept, they must be flushed first (NVMCache_Sync).
+	 **/
+
+	for(uint8_t i = 0; i < NVM_CACHE_LINES; i++) {
+		if(NVM_cache.line[i].dirty_mask == 0) NVM_cache.line[i].base_addr = 0;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.1
+ *  File: NVMCache_STM32L0x3.h
+ *
+ *      This is a RAM write-back cache of FLASH half pages.
+ *      Word writes are merged in RAM and only reach the FLASH as half page bursts, on a timer, when the cache is full or on NVMCache_Sync.
+ */
+
+#ifndef INC_NVMCACHE_STM32L0x3_H_
+#define INC_NVMCACHE_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define NVM_CACHE_LINES				4			//half pages the cache holds (256 bytes of RAM)
+#define NVM_CACHE_LINE_WORDS		NVM_CFG_HALF_PAGE_WORDS	//a line is one half page
+#define NVM_CACHE_FLUSH_MS			1000		//a dirty line is flushed at the latest this long after its first change
+
+//LOCAL VARIABLE
+typedef struct {
+	uint32_t data [NVM_CACHE_LINE_WORDS];		//current content of the half page
+	uint32_t base_addr;							//half page address, 0 if the line is free
+	uint16_t dirty_mask;						//words changed since the last flush, one bit each
+	uint32_t dirty_tick;						//HAL tick of the first change since the last flush
+	uint32_t use_tick;							//HAL tick of the last access, for the LRU replacement
+} NVMCache_Line_TypeDef;
+
+typedef struct {
+	NVMCache_Line_TypeDef line [NVM_CACHE_LINES];
+	uint32_t write_cnt;							//NVMCache_Write calls
+	uint32_t merge_cnt;							//writes that landed on a word already dirty, each one is a FLASH write spared
+	uint32_t flush_cnt;							//half pages written into the FLASH
+	uint8_t last_status;						//status of the last flush
+} NVMCache_TypeDef;
+
+//EXTERNAL VARIABLE
+extern NVMCache_TypeDef NVM_cache;
+
+//FUNCTION PROTOTYPES
+uint8_t NVMCache_Write(uint32_t flash_addr, uint32_t value);
+uint32_t NVMCache_Read(uint32_t flash_addr);
+uint8_t NVMCache_Sync(void);
+void NVMCache_Poll(void);
+void NVMCache_Invalidate(void);
+
+#endif /* INC_NVMCACHE_STM32L0x3_H_ */
@@ -0,0 +1,87 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.3
+ *  File: NVMConfig_STM32L0x3.h
+ *
+ *      This is the NVM geometry of the target, in one place.
+ *      Everything here is a compile-time constant, so the page math and the loop bounds of the driver fold into immediates.
+ *      The part is picked with one of the "nvm_part_" defines, the NUCLEO-L053R8 (64 kbytes) is the default.
+ *      The values the linker script also knows (app slots, FLASH size) are exported to it by NVMDriver_STM32L0x3.c and checked there with ASSERTs, so a mismatch fails the link.
+ *      Every part has its own linker script: STM32L053R8TX_FLASH.ld (default), STM32L073RBTX_FLASH.ld (nvm_part_l0_128k), STM32L073RZTX_FLASH.ld (nvm_part_l0_192k).
+ */
+
+#ifndef INC_NVMCONFIG_STM32L0x3_H_
+#define INC_NVMCONFIG_STM32L0x3_H_
+
+#include "stdint.h"
+
+//LOCAL CONSTANT
+#if defined(nvm_part_l0_192k) && defined(nvm_part_l0_128k)
+#error "Only one nvm_part_ define can be used!"
+#endif
+
+#if defined(nvm_part_l0_192k)										//L0x1/L0x2/L0x3 category 5, e.g. STM32L073RZ
+#define NVM_CFG_FLASH_SIZE			0x30000		//192 kbytes
+#define NVM_CFG_EEPROM_SIZE			0x1800		//6 kbytes
+#define NVM_CFG_DUAL_BANK			1
+#define NVM_CFG_TELEM_BUCKET_SHIFT	13			//8 kbyte buckets, 24 of them
+#elif defined(nvm_part_l0_128k)										//category 5, e.g. STM32L072CB, STM32L073RB
+#define NVM_CFG_FLASH_SIZE			0x20000		//128 kbytes
+#define NVM_CFG_EEPROM_SIZE			0x1800		//6 kbytes
+#define NVM_CFG_DUAL_BANK			1
+#define NVM_CFG_TELEM_BUCKET_SHIFT	13			//8 kbyte buckets, 16 of them
+#else																//category 3, e.g. STM32L051R8, STM32L052R8, STM32L053R8
+#define NVM_CFG_FLASH_SIZE			0x10000		//64 kbytes
+#define NVM_CFG_EEPROM_SIZE			0x800		//2 kbytes
+#define NVM_CFG_DUAL_BANK			0
+#define NVM_CFG_TELEM_BUCKET_SHIFT	12			//4 kbyte buckets, 16 of them
+#endif
+
+#define NVM_CFG_FLASH_BASE			0x08000000
+#define NVM_CFG_EEPROM_BASE			0x08080000
+
+#if NVM_CFG_DUAL_BANK
+#define NVM_CFG_BANK_SIZE			(NVM_CFG_FLASH_SIZE / 2)	//the two banks split the FLASH in half
+#else
+#define NVM_CFG_BANK_SIZE			NVM_CFG_FLASH_SIZE
+#endif
+#define NVM_CFG_BANK2_BASE			(NVM_CFG_FLASH_BASE + NVM_CFG_BANK_SIZE)	//same as the end of the FLASH on a single bank part
+
+#define NVM_CFG_PAGE_BYTES			128			//erase unit, same on every L0
+#define NVM_CFG_PAGE_WORDS			(NVM_CFG_PAGE_BYTES / 4)
+#define NVM_CFG_PAGE_MASK			(NVM_CFG_PAGE_BYTES - 1)
+#define NVM_CFG_HALF_PAGE_BYTES		(NVM_CFG_PAGE_BYTES / 2)	//half page programming unit
+#define NVM_CFG_HALF_PAGE_WORDS		(NVM_CFG_HALF_PAGE_BYTES / 4)
+#define NVM_CFG_HALF_PAGE_MASK		(NVM_CFG_HALF_PAGE_BYTES - 1)
+
+#define NVM_CFG_PEKEY1				0x89ABCDEF	//PECR unlock keys
+#define NVM_CFG_PEKEY2				0x02030405
+#define NVM_CFG_PRGKEY1				0x8C9DAEBF	//program memory unlock keys
+#define NVM_CFG_PRGKEY2				0x13141516
+
+#define NVM_CFG_APP_SLOT_SIZE		0x2000		//8 kbytes, must match APP_MEM and APP_MEM_B in the linker script
+#define NVM_CFG_APP_SLOT_B			(NVM_CFG_FLASH_BASE + NVM_CFG_FLASH_SIZE - NVM_CFG_APP_SLOT_SIZE)
+#define NVM_CFG_APP_SLOT_A			(NVM_CFG_APP_SLOT_B - NVM_CFG_APP_SLOT_SIZE)
+												//the two slots are at the top of the FLASH
+#define NVM_CFG_DATA_SIZE			0x1200		//NVM_COUNTER to APP_CONST, the NVM data pages right below slot A
+#define NVM_CFG_DATA_BASE			(NVM_CFG_APP_SLOT_A - NVM_CFG_DATA_SIZE)
+
+_Static_assert((NVM_CFG_PAGE_BYTES & NVM_CFG_PAGE_MASK) == 0, "page size must be a power of 2");
+_Static_assert((NVM_CFG_APP_SLOT_A & NVM_CFG_PAGE_MASK) == 0, "app slots must start on a page");
+_Static_assert((NVM_CFG_APP_SLOT_SIZE & NVM_CFG_PAGE_MASK) == 0, "app slots must be whole pages");
+_Static_assert((NVM_CFG_DATA_SIZE & NVM_CFG_PAGE_MASK) == 0, "the NVM data area must be whole pages");
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern uint32_t __app_slot_a_start__;
+extern uint32_t __app_slot_b_start__;
+extern uint32_t __app_slot_size__;
+extern uint32_t __app_section_start__;
+
+//FUNCTION PROTOTYPES
+
+#endif /* INC_NVMCONFIG_STM32L0x3_H_ */
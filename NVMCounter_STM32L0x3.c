@@ -0,0 +1,204 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.2
+ *  File: NVMCounter_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below are program-only counters and bitmaps.
+ * On L0xx, an erased word reads 0 and a word can only be programmed while it is 0 (NOTZEROERR otherwise). So the smallest step that needs no erase is one word, and not one bit.
+ * A counter is a thermometer: each increment programs the next erased word of its page. The value is the base of the page plus the number of programmed words.
+ * The programmed words are always at the start of the page, so the number of them is found with a binary search of 5 reads, not by reading all 30.
+ * Each counter has a ring of NVM_CNT_PAGES pages. When a page is full, the next one in the ring (the oldest) is erased and gets the current value as its base. The newest page is the valid one with the highest base.
+ * A page is full after 30 increments, so there is one erase every 30 increments. With 3 pages, each page is hit by one of them every 90 increments.
+ * A bitmap is a page of 32 flags, one word each. A flag can only be set. Clearing is for the whole bitmap at once, with an erase.
+ *
+ * Note: the base is written before the magic, so a page cut by a power loss while it was being set up is not valid and is simply set up again.
+ *
+ * v.1.1
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.2
+ * The erase rate in the notes is one erase every 30 increments, the ring only spreads it over the pages.
+ *
+ */
+
+#include "NVMCounter_STM32L0x3.h"
+
+
+//0)Local helpers
+static uint32_t NVMCounter_PageAddr(uint8_t counter, uint8_t page) {
+	return (uint32_t)&__nvm_counter_start__ + ((((uint32_t)counter * NVM_CNT_PAGES) + page) * NVM_CFG_PAGE_BYTES);
+}
+
+static uint32_t NVMBitmap_PageAddr(uint8_t bitmap) {
+	return (uint32_t)&__nvm_counter_start__ + ((((uint32_t)NVM_CNT_COUNTERS * NVM_CNT_PAGES) + bitmap) * NVM_CFG_PAGE_BYTES);
+}
+
+static uint8_t NVMCounter_Marks(uint32_t page_addr) {
+	/**
+	 * Binary search of the first erased thermometer word.
+	 **/
+
+	uint8_t low = 0;
+	uint8_t high = NVM_CNT_MARKS_PER_PAGE;
+	uint8_t mid;
+
+	while(low < high) {
+		mid = (low + high) >> 1;
+		if(*(__IO uint32_t*)(page_addr + 8 + ((uint32_t)mid * 4)) != 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+static uint8_t NVMCounter_Newest(uint8_t counter) {
+	/**
+	 * Returns the page of the ring with the highest base, or NVM_CNT_PAGES if no page is valid.
+	 **/
+
+	uint8_t newest = NVM_CNT_PAGES;
+	uint32_t newest_base = 0;
+	uint32_t* page_ptr;
+
+	for(uint8_t page = 0; page < NVM_CNT_PAGES; page++) {
+		page_ptr = (uint32_t*)NVMCounter_PageAddr(counter, page);
+		if(page_ptr[0] != NVM_CNT_MAGIC) continue;
+		if((newest == NVM_CNT_PAGES) || (page_ptr[1] > newest_base)) {
+			newest = page;
+			newest_base = page_ptr[1];
+		}
+	}
+
+	return newest;
+}
+
+static uint8_t NVMCounter_SetupPage(uint32_t page_addr, uint32_t base) {
+	uint8_t status = NVM_OK;
+
+	if(FLASHPage_IsBlank(page_addr) == 0) status = FLASHErase_Page(page_addr);
+	if(status == NVM_OK) status = FLASHUpd_WordOrder(page_addr + 4, base, NVM_BYTE_ORDER_NATIVE);
+	if(status == NVM_OK) status = FLASHUpd_WordOrder(page_addr, NVM_CNT_MAGIC, NVM_BYTE_ORDER_NATIVE);
+												//Note: the magic is written last, it makes the page valid
+	return status;
+}
+
+
+//1)Increment a counter
+uint8_t NVMCounter_Increment(uint8_t counter) {
+	/**
+	 * 1)Find the newest page of the counter, set up the first page of the ring if there is none
+	 * 2)Program the next thermometer word, if the page has one left
+	 * 3)Otherwise, move on to the next page of the ring with the current value as its base
+	 *
+	 * Returns NVM_OK or an NVM_ERR_ code.
+	 **/
+
+	uint8_t status = NVM_OK;
+	uint8_t page;
+	uint8_t marks;
+	uint32_t page_addr;
+
+	if(counter >= NVM_CNT_COUNTERS) return NVM_ERR_RANGE;
+
+	NVM_SessionBegin();
+
+	//1)
+	page = NVMCounter_Newest(counter);
+	if(page == NVM_CNT_PAGES) {
+		page = 0;
+		status = NVMCounter_SetupPage(NVMCounter_PageAddr(counter, 0), 0);
+	}
+	page_addr = NVMCounter_PageAddr(counter, page);
+	marks = NVMCounter_Marks(page_addr);
+
+	//3)
+	if((status == NVM_OK) && (marks == NVM_CNT_MARKS_PER_PAGE)) {
+		uint32_t base = *(__IO uint32_t*)(page_addr + 4) + NVM_CNT_MARKS_PER_PAGE;
+		page = (page + 1) % NVM_CNT_PAGES;
+		page_addr = NVMCounter_PageAddr(counter, page);
+		status = NVMCounter_SetupPage(page_addr, base);
+		marks = 0;
+	}
+
+	//2)
+	if(status == NVM_OK) status = FLASHUpd_WordOrder(page_addr + 8 + ((uint32_t)marks * 4), NVM_CNT_MARK, NVM_BYTE_ORDER_NATIVE);
+
+	NVM_SessionEnd();
+
+	return status;
+}
+
+
+//2)Read a counter
+uint32_t NVMCounter_Read(uint8_t counter) {
+	/**
+	 * A few header reads and a 5 step binary search. A counter that was never incremented reads 0.
+	 **/
+
+	uint8_t page;
+	uint32_t page_addr;
+
+	if(counter >= NVM_CNT_COUNTERS) return 0;
+
+	page = NVMCounter_Newest(counter);
+	if(page == NVM_CNT_PAGES) return 0;
+
+	page_addr = NVMCounter_PageAddr(counter, page);
+	return *(__IO uint32_t*)(page_addr + 4) + NVMCounter_Marks(page_addr);
+}
+
+
+//3)Set a flag
+uint8_t NVMBitmap_Set(uint8_t bitmap, uint8_t bit) {
+	/**
+	 * Programs the word of the flag. A flag that is already set is not written again.
+	 **/
+
+	uint32_t word_addr;
+
+	if((bitmap >= NVM_CNT_BITMAPS) || (bit >= NVM_BITMAP_BITS)) return NVM_ERR_RANGE;
+
+	word_addr = NVMBitmap_PageAddr(bitmap) + ((uint32_t)bit * 4);
+	if(*(__IO uint32_t*)(word_addr) != 0) return NVM_OK;
+
+	return FLASHUpd_WordOrder(word_addr, NVM_CNT_MARK, NVM_BYTE_ORDER_NATIVE);
+}
+
+
+//4)Test a flag
+uint8_t NVMBitmap_Test(uint8_t bitmap, uint8_t bit) {
+	if((bitmap >= NVM_CNT_BITMAPS) || (bit >= NVM_BITMAP_BITS)) return 0;
+	return (*(__IO uint32_t*)(NVMBitmap_PageAddr(bitmap) + ((uint32_t)bit * 4)) != 0);
+}
+
+
+//5)Count the set flags
+uint8_t NVMBitmap_Count(uint8_t bitmap) {
+	uint8_t set_cnt = 0;
+	uint32_t* page_ptr;
+
+	if(bitmap >= NVM_CNT_BITMAPS) return 0;
+
+	page_ptr = (uint32_t*)NVMBitmap_PageAddr(bitmap);
+	for(uint8_t i = 0; i < NVM_BITMAP_BITS; i++) {
+		if(page_ptr[i] != 0) set_cnt++;
+	}
+
+	return set_cnt;
+}
+
+
+//6)Clear all the flags
+uint8_t NVMBitmap_Clear(uint8_t bitmap) {
+	if(bitmap >= NVM_CNT_BITMAPS) return NVM_ERR_RANGE;
+	if(FLASHPage_IsBlank(NVMBitmap_PageAddr(bitmap)) == 1) return NVM_OK;
+	return FLASHErase_Page(NVMBitmap_PageAddr(bitmap));
+}
@@ -0,0 +1,48 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.1
+ *  File: NVMCounter_STM32L0x3.h
+ *
+ *      These are monotonic counters and flag bitmaps in the NVM_COUNTER memory area of the FLASH.
+ *      They only ever move forward by programming an erased word, so they need an erase only once a page is used up.
+ */
+
+#ifndef INC_NVMCOUNTER_STM32L0x3_H_
+#define INC_NVMCOUNTER_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define NVM_CNT_COUNTERS			2			//number of counters
+#define NVM_CNT_PAGES				3			//pages in the ring of each counter
+#define NVM_CNT_BITMAPS				2			//number of flag bitmaps, one page each
+#define NVM_CNT_AREA_PAGES			((NVM_CNT_COUNTERS * NVM_CNT_PAGES) + NVM_CNT_BITMAPS)
+
+#define NVM_CNT_MARKS_PER_PAGE		(NVM_CFG_PAGE_WORDS - 2)	//2 words of header (magic, base), then 30 thermometer words
+#define NVM_CNT_MAGIC				0x434E5452	//"CNTR", marks a page that has a valid base
+#define NVM_CNT_MARK				0xFFFFFFFF	//value of a set thermometer word
+#define NVM_BITMAP_BITS				NVM_CFG_PAGE_WORDS	//flags in a bitmap, one word each
+
+_Static_assert((NVM_CNT_AREA_PAGES * NVM_CFG_PAGE_BYTES) <= 1024, "counters and bitmaps don't fit into the NVM_COUNTER area");
+_Static_assert(NVM_CNT_PAGES >= 2, "a counter needs at least two pages to move on without losing its value");
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern uint32_t __nvm_counter_start__;
+
+//FUNCTION PROTOTYPES
+uint8_t NVMCounter_Increment(uint8_t counter);
+uint32_t NVMCounter_Read(uint8_t counter);
+uint8_t NVMBitmap_Set(uint8_t bitmap, uint8_t bit);
+uint8_t NVMBitmap_Test(uint8_t bitmap, uint8_t bit);
+uint8_t NVMBitmap_Count(uint8_t bitmap);
+uint8_t NVMBitmap_Clear(uint8_t bitmap);
+
+#endif /* INC_NVMCOUNTER_STM32L0x3_H_ */
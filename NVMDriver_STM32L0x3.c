@@ -3,7 +3,7 @@
  *  Author: BalazsFarkas
  *  Project: STM32_NVMDriver
  *  Processor: STM32L053R8
- *  Program version: 1.0
+ *  Program version: 2.8
  *  File: NVMDriver_STM32L0x3.c
  *  Change history:
  *
@@ -13,10 +13,460 @@
  * In some devices, writing to FLASH is blocked until the target is erased. With others, the result will be the bitwise OR of the original and the new word.
  * Erasing FLASH is at least 8 x 4 x 32 bit. It is not possible to erase just a word or a byte.
  *
+ * v.1.1
+ * Added a streaming half-page writer that programs consecutive half pages from a RAM buffer within one unlock/lock cycle.
+ *
+ * v.1.2
+ * Added NVM sessions. Between NVM_SessionBegin and NVM_SessionEnd the PECR and the FLASH stay unlocked and the primitives skip the key sequences and the relocking.
+ *
+ * v.1.3
+ * Added an asynchronous mode. Erase/program operations are queued and then executed one after the other from the EOP interrupt, with a completion callback at the end.
+ *
+ * v.1.4
+ * Added a blank page check and a range erase that skips pages which are already erased.
+ *
+ * v.1.5
+ * Added a delta update that compares new data with the FLASH and only erases/writes the pages and half pages that differ.
+ *
+ * v.1.6
+ * Added a half-page writer that loads the latch with a memory-to-memory DMA transfer and only masks the IRQs below a priority threshold while doing so.
+ *
+ * v.1.7
+ * The half-page writers only mask the IRQs while the latch is loaded, not for the whole programming time. The length of each masked window is measured with SysTick and the last/worst values are kept in NVM_irq_window.
+ *
+ * v.1.8
+ * Added a free running cycle counter (NVM_GetCycles) for timing the primitives.
+ *
+ * v.1.9
+ * The BSY/EOP polling of the blocking primitives is done by a single helper (NVM_WaitDone).
+ * Added optional telemetry ("nvm_telemetry" define): operation counts, the cycles spent polling BSY/EOP and an erase histogram of the FLASH in 1 kbyte (8 page) buckets.
+ * The histogram is kept in RAM and saved into the reserved NVM_TELEM page by NVM_TelemetrySave, so it survives a reset.
+ *
+ * v.2.0
+ * The blocking primitives return a status code (NVM_OK or NVM_ERR_...) instead of nothing. The BSY/EOP wait has a timeout and checks the error flags, so a failed operation doesn't hang the code anymore.
+ * Added an optional retry policy with exponential backoff for the transient errors (timeout, fetch while write). Programming is only retried if the target is still blank.
+ * FLASH_IRQHandler doesn't stop the code anymore. It logs the error into NVM_last_error, clears the flags and aborts the asynchronous queue, if it is running.
+ *
+ * v.2.1
+ * Added a CRC of a FLASH region and a verification of written data, both using the CRC peripheral.
+ * With the "nvm_verify" define, the word and half-page writers check what they have written and return NVM_ERR_VERIFY if it doesn't match.
+ *
+ * v.2.2
+ * The byte order is an attribute of each word write and stream (FLASHUpd_WordOrder, FLASHUpd_HalfPageStreamOrder). Swapping uses a single REV per word, done while the word is written, so a swapped image needs no separate pass in RAM.
+ * FLASHUpd_Word, FLASHUpd_HalfPage and FLASHUpd_HalfPageStream always write NATIVE, so what is read back from the FLASH (e.g. by the delta update) is written back as it was.
+ *
+ * v.2.3
+ * Added a data EEPROM backend: byte, half-word and word writes that need no erase beforehand.
+ * Added NVM_Write as a common entry for both backends, picked by the target address, and NVM_Route, a routing policy that picks the backend of a record by its size and update rate.
+ *
+ * v.2.4
+ * Added a low power mode (NVM_SetLowPower). The blocking primitives put the core into Sleep (WFI) while the FLASH is busy, and the EOP/error IRQ wakes it up.
+ * The asynchronous queue can be started deferred (NVM_AsyncStartDeferred): it is only launched by NVM_IdlePoll once the application has been idle for a configurable window.
+ *
+ * v.2.5
+ * The geometry (page and half page size, FLASH/EEPROM size) and the keys come from NVMConfig_STM32L0x3.h instead of literals. NVM_Init checks the config against the linker script (NVM_ConfigCheck).
+ *
+ * v.2.6
+ * Added bank-aware addressing for the dual bank (category 5) parts. A write into the bank we are not executing from can run while the code keeps running from FLASH (read-while-write).
+ * FLASHUpd_HalfPageRWW is such a half page writer: it runs from FLASH and doesn't mask the IRQs. FLASHUpd_HalfPageStreamBank picks it whenever the target allows it, the RAM writer otherwise. The asynchronous queue and the delta update use the same logic.
+ * Limit: the target must be in a bank that holds neither the code nor the app (APP_API, APP_CONST and both slots). In the L073 memory maps the app slots share bank 2 with the NVM data areas, so an A/B update is not written in the background: it falls back to the RAM writer, since a write from FLASH would stall the running slot anyway.
+ *
+ * v.2.7
+ * Added read views (NVM_ViewOpen) that give a checked, zero-copy pointer into FLASH or EEPROM, together with word compare and scan helpers that load four words with one LDM.
+ * NVM_Init enables the prefetch and the pre-read buffers when the FLASH runs with one wait state. The blank check uses the scan, and the delta update compares each page with NVM_WordCompare and skips the unchanged ones without merging them into the page buffer.
+ * FLASHVerify stays on the CRC peripheral (see v.2.1).
+ *
+ * v.2.8
+ * The IRQ flags of a blocking operation are cleared before the operation starts (NVM_WaitArm), not when the wait starts.
+ * NVMConfig is exported to the linker script as absolute symbols, so a config that doesn't match the memory map fails the link. NVM_ConfigCheck stays as a backstop and stops the code on a mismatch.
+ * FLASHUpd_Delta returns a status code instead of the number of erased pages. Added NVM_RecordPlace, which turns the backend NVM_Route picks into an address for NVM_Write.
+ * FLASHUpd_HalfPageDMA also gates SysTick (TICKINT) when it masks by threshold, since the NVIC doesn't cover the system exceptions.
+ * NVM_IrqWindowReset restores PRIMASK instead of enabling the IRQs unconditionally.
+ * The telemetry counts every page of the NVM data area separately (coarse buckets only for the code and the app slots), and NVM_TelemetryPoll saves the log every NVM_TELEM_SAVE_EVERY erases or when a counter crosses NVM_TELEM_WEAR_STEP.
+ * NVM_IdlePoll keeps a deferred start pending until NVM_AsyncStart accepts it.
+ * FLASHUpd_HalfPageRWWOrder and FLASHUpd_HalfPageStreamBankOrder take a byte order like FLASHUpd_HalfPageStreamOrder. FLASHUpd_HalfPageRWW and FLASHUpd_HalfPageStreamBank are their NATIVE versions.
+ * NVM_RwwTarget checks the whole code extent (__nvm_code_start__ to __nvm_code_end__ from the linker script) and the app extent (__nvm_app_start__ to __nvm_app_end__), and FLASHUpd_HalfPageRWW verifies its writes with "nvm_verify".
+ *
  */
 
 #include "NVMDriver_STM32L0x3.h"
 #include "main.h"
+#include "stdio.h"
+
+//NVMConfig exported as absolute symbols. The linker script ASSERTs its memory map against them, so a "nvm_part_" define that doesn't match the linker script fails the link.
+//Note: the values are expanded into the assembler source as expressions, the assembler does the math
+#define NVM_CFG_STR_(x)						#x
+#define NVM_CFG_STR(x)						NVM_CFG_STR_(x)
+
+__asm__(".global __nvm_cfg_app_slot_a__\n\t.set __nvm_cfg_app_slot_a__, " NVM_CFG_STR(NVM_CFG_APP_SLOT_A) "\n\t"
+		".global __nvm_cfg_app_slot_b__\n\t.set __nvm_cfg_app_slot_b__, " NVM_CFG_STR(NVM_CFG_APP_SLOT_B) "\n\t"
+		".global __nvm_cfg_app_slot_size__\n\t.set __nvm_cfg_app_slot_size__, " NVM_CFG_STR(NVM_CFG_APP_SLOT_SIZE) "\n\t"
+		".global __nvm_cfg_flash_end__\n\t.set __nvm_cfg_flash_end__, " NVM_CFG_STR(NVM_CFG_FLASH_BASE + NVM_CFG_FLASH_SIZE) "\n\t"
+		".global __nvm_cfg_bank2_base__\n\t.set __nvm_cfg_bank2_base__, " NVM_CFG_STR(NVM_CFG_BANK2_BASE) "\n\t"
+		".global __nvm_cfg_data_base__\n\t.set __nvm_cfg_data_base__, " NVM_CFG_STR(NVM_CFG_DATA_BASE));
+
+//NVM session object
+NVM_Session_TypeDef NVM_session = {0};
+
+//Asynchronous operation queue
+NVM_Async_TypeDef NVM_async = {0};
+
+//Page buffer for the delta update
+uint32_t NVM_page_buf [NVM_CFG_PAGE_WORDS];
+
+//Next free address of the EEPROM records (see NVM_RecordPlace)
+uint32_t NVM_eeprom_next = NVM_EEPROM_BASE;
+
+//IRQ-masked window measurement
+NVM_IrqWindow_TypeDef NVM_irq_window = {0};
+
+//Low power mode and idle window
+NVM_LowPower_TypeDef NVM_lowpower = {0};
+
+//Last error and retry policy
+NVM_Error_TypeDef NVM_last_error = {0};
+NVM_RetryPolicy_TypeDef NVM_retry = {0};
+
+#ifdef nvm_telemetry
+//Telemetry counters and erase log
+NVM_Telemetry_TypeDef NVM_telemetry = {0};
+
+_Static_assert(sizeof(NVM_TelemetryLog_TypeDef) == NVM_CFG_PAGE_BYTES, "the erase log must fill the NVM_TELEM page");
+_Static_assert((NVM_CFG_FLASH_SIZE >> NVM_TELEM_BUCKET_SHIFT) <= NVM_TELEM_BUCKET_CNT, "not enough erase buckets for the FLASH");
+#endif
+
+static void NVM_AsyncStep(void);
+static void NVM_AsyncAbort(uint8_t status);
+
+
+//0)Local unlock/lock helpers
+__attribute__((section(".RamFunc"))) static void NVM_UnlockPECR(void) {
+	/**
+	 * These are shared by all the erase/program primitives below.
+	 * The keys are only written if the hardware lock is actually engaged. Writing the key sequence to an already unlocked register is not only useless, but it is considered a wrong sequence and locks the NVM until the next reset.
+	 * Locking is skipped while an NVM session is open (see NVM_SessionBegin), so a batch of operations only goes through the unlock sequence once.
+	 * The helpers are placed in RAM, so they can be called by the functions that MUST run from RAM.
+	 **/
+
+	if((FLASH->PECR & (1<<0)) == (1<<0)) {		//if PELOCK is 1
+		FLASH->PEKEYR = NVM_CFG_PEKEY1;			//PEKEY1
+		FLASH->PEKEYR = NVM_CFG_PEKEY2;			//PEKEY2
+	}
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_UnlockPRG(void) {
+	if((FLASH->PECR & (1<<1)) == (1<<1)) {		//if PRGLOCK is 1
+		FLASH->PRGKEYR = NVM_CFG_PRGKEY1;		//RRGKEY1
+		FLASH->PRGKEYR = NVM_CFG_PRGKEY2;		//RRGKEY2
+	}
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_Lock(void) {
+	if(NVM_session.depth == 0) {
+		FLASH->PECR |= (1<<0);					//we set PELOCK on the NVM to 1, which also sets PRGLOCK and OPTLOCK
+	}
+}
+
+__attribute__((section(".RamFunc"))) static uint32_t NVM_IrqWindowOpen(uint32_t* primask) {
+	/**
+	 * The IRQ window helpers mask the IRQs for the half-page latch load and measure how long they were masked, in core clock cycles.
+	 * The measurement uses the SysTick counter, since the Cortex-M0+ has no DWT cycle counter. SysTick counts down from LOAD to 0 and reloads, so one wrap is accounted for (the window is much shorter than a tick).
+	 * The PRIMASK state is saved and restored, so the helpers can be used with the IRQs already masked (e.g. within an IRQ handler that did so).
+	 **/
+
+	*primask = __get_PRIMASK();
+	__disable_irq();							//we disable all the IRQs
+	return SysTick->VAL;						//start of the window
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_IrqWindowClose(uint32_t primask, uint32_t window_start) {
+	uint32_t window_end = SysTick->VAL;			//end of the window
+	uint32_t window_cycles;
+
+	if(window_start >= window_end) {
+		window_cycles = window_start - window_end;
+	} else {
+		window_cycles = window_start + (SysTick->LOAD + 1) - window_end;
+												//SysTick has reloaded within the window
+	}
+
+	__set_PRIMASK(primask);						//we re-enable the IRQs, unless they were already disabled when we started
+
+	NVM_irq_window.last_cycles = window_cycles;
+	if(window_cycles > NVM_irq_window.worst_cycles) NVM_irq_window.worst_cycles = window_cycles;
+	NVM_irq_window.window_cnt++;
+}
+
+#ifdef nvm_telemetry
+__attribute__((section(".RamFunc"))) static void NVM_TelemLogErase(uint32_t flash_page_addr) {
+	/**
+	 * Counts an erase in the erase log and flags the save when it is due (see NVM_TelemetryPoll).
+	 * The telemetry helpers only exist with the "nvm_telemetry" define, otherwise the NVM_TELEM_ macros are empty.
+	 **/
+
+	uint16_t* counter_ptr = 0;
+
+	if((flash_page_addr >= NVM_TELEM_DATA_BASE) && (flash_page_addr < (NVM_TELEM_DATA_BASE + NVM_CFG_DATA_SIZE))) {
+		counter_ptr = &NVM_telemetry.log.page_hist[(flash_page_addr - NVM_TELEM_DATA_BASE) / NVM_CFG_PAGE_BYTES];
+												//the NVM data pages are counted one by one
+	} else if(((flash_page_addr - NVM_TELEM_FLASH_BASE) >> NVM_TELEM_BUCKET_SHIFT) < NVM_TELEM_BUCKET_CNT) {
+		counter_ptr = &NVM_telemetry.log.bucket_hist[(flash_page_addr - NVM_TELEM_FLASH_BASE) >> NVM_TELEM_BUCKET_SHIFT];
+	}
+
+	NVM_telemetry.erase_cnt++;
+	NVM_telemetry.log.erase_total++;
+	NVM_telemetry.unsaved_cnt++;
+
+	if((counter_ptr != 0) && (*counter_ptr != 0xFFFF)) {
+		(*counter_ptr)++;						//saturates instead of wrapping around
+		if((*counter_ptr & (NVM_TELEM_WEAR_STEP - 1)) == 0) NVM_telemetry.save_pending = 1;
+												//a page crossing a wear step is saved right away
+	}
+
+	if(NVM_telemetry.unsaved_cnt >= NVM_TELEM_SAVE_EVERY) NVM_telemetry.save_pending = 1;
+												//we can't save from here: we are inside an erase, maybe in the FLASH IRQ
+}
+
+#define NVM_TELEM_ERASE(addr)				NVM_TelemLogErase(addr)
+#define NVM_TELEM_WORD()					(NVM_telemetry.word_cnt++)
+#define NVM_TELEM_HALF_PAGE()				(NVM_telemetry.half_page_cnt++)
+#else
+#define NVM_TELEM_ERASE(addr)
+#define NVM_TELEM_WORD()
+#define NVM_TELEM_HALF_PAGE()
+#endif
+
+//NVM_LDM4 loads four consecutive words into w0..w3 with a single LDM and steps the pointer by four words.
+//An LDM of four words is one instruction fetch and four back-to-back data reads. With one wait state, the pre-read buffer keeps these sequential FLASH reads at bus speed.
+//Note: the register list of an LDM must be in ascending order, so the words are pinned to r0..r3
+//Note: r7 is not used, it is the frame pointer of the Thumb code at -O0/-Og (Debug builds)
+//Note: outside of Thumb (e.g. a host build), the same is done with four plain loads
+#ifdef __thumb__
+#define NVM_LDM4(ptr, w0, w1, w2, w3)		do { \
+												register uint32_t r0_ __asm__("r0"); \
+												register uint32_t r1_ __asm__("r1"); \
+												register uint32_t r2_ __asm__("r2"); \
+												register uint32_t r3_ __asm__("r3"); \
+												__asm volatile ("ldmia %0!, {r0-r3}" : "+l" (ptr), "=r" (r0_), "=r" (r1_), "=r" (r2_), "=r" (r3_) : : "memory"); \
+												(w0) = r0_; (w1) = r1_; (w2) = r2_; (w3) = r3_; \
+											} while(0)
+#else
+#define NVM_LDM4(ptr, w0, w1, w2, w3)		do { \
+												(w0) = (ptr)[0]; (w1) = (ptr)[1]; (w2) = (ptr)[2]; (w3) = (ptr)[3]; \
+												(ptr) = (ptr) + 4; \
+											} while(0)
+#endif
+
+__attribute__((section(".RamFunc"))) static uint8_t NVM_ErrorFromSR(uint32_t flash_sr) {
+	/**
+	 * The error helpers turn the SR error flags into a status code and log it into NVM_last_error.
+	 * The first flag found wins, in the order of the SR bits.
+	 **/
+
+	if((flash_sr & (1<<8)) == (1<<8)) return NVM_ERR_WRP;		//WRPERR
+	if((flash_sr & (1<<9)) == (1<<9)) return NVM_ERR_PGA;		//PGAERR
+	if((flash_sr & (1<<10)) == (1<<10)) return NVM_ERR_SIZE;	//SIZERR
+	if((flash_sr & (1<<11)) == (1<<11)) return NVM_ERR_OPTV;	//OPTVERR
+	if((flash_sr & (1<<13)) == (1<<13)) return NVM_ERR_RD;		//RDERR
+	if((flash_sr & (1<<16)) == (1<<16)) return NVM_ERR_NOTZERO;	//NOTZEROERR
+	if((flash_sr & (1<<17)) == (1<<17)) return NVM_ERR_FWW;		//FWWERR
+	return NVM_OK;
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_LogError(uint8_t status, uint32_t flash_sr) {
+	NVM_last_error.status = status;
+	NVM_last_error.flash_sr = flash_sr;
+	NVM_last_error.error_cnt++;
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_SleepWhileBusy(void) {
+	/**
+	 * Sleeps until the next IRQ, unless the FLASH is already done.
+	 * The IRQs are masked between the check and the WFI, so an EOP that comes in between still ends the WFI and is not missed: a pending IRQ wakes the core even with PRIMASK set. The IRQ runs once PRIMASK is restored.
+	 * SysTick also wakes the core every ms, so the timeout of NVM_WaitDone keeps counting.
+	 **/
+
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if((NVM_lowpower.op_done == 0) && ((FLASH->SR & (1<<0)) == (1<<0))) {
+		__WFI();								//Sleep mode, SLEEPDEEP is 0 (see NVM_SetLowPower)
+		NVM_lowpower.sleep_cnt++;
+	}
+	__set_PRIMASK(primask);
+}
+
+__attribute__((section(".RamFunc"))) static void NVM_WaitArm(void) {
+	/**
+	 * Clears what the FLASH IRQ reports for a blocking operation (NVM_last_error.irq_pending and NVM_lowpower.op_done).
+	 * Must be called right before the erase/program is started. Clearing them in NVM_WaitDone would drop an error the IRQ catches in between.
+	 **/
+
+	NVM_last_error.irq_pending = 0;
+	NVM_lowpower.op_done = 0;
+}
+
+__attribute__((section(".RamFunc"))) static uint8_t NVM_WaitDone(void) {
+	/**
+	 * Waits until the ongoing erase/program is done and resets EOP.
+	 * The wait is bounded by NVM_TIMEOUT_MS and stops at the first error flag. The error flags are cleared before returning.
+	 * The milliseconds are counted with the COUNTFLAG of SysTick (set at every 1 ms reload) and not with the HAL tick, so the timeout works even if the SysTick IRQ can't run (e.g. when called from a higher priority IRQ).
+	 * The FLASH IRQ (if enabled) may see and clear the error flags first. It then sets NVM_last_error.irq_pending, which we pick up here.
+	 * Note: irq_pending and op_done are cleared by NVM_WaitArm before the operation is started, so an error the IRQ catches before we get here is not lost.
+	 * With telemetry, the time spent in here is added to the busy cycles.
+	 * In low power mode, the core sleeps between the checks. This is only done in thread mode: within an IRQ handler, the FLASH IRQ can't preempt us, so it couldn't wake us up. The FLASH IRQ then flags the end of the operation in NVM_lowpower.op_done, as it has to clear EOP to stop firing.
+	 *
+	 * Returns NVM_OK, NVM_ERR_TIMEOUT or the error code of the flag raised.
+	 **/
+
+#ifdef nvm_telemetry
+	uint32_t wait_start = NVM_GetCycles();
+#endif
+	uint32_t elapsed_ms = 0;
+	uint32_t flash_sr;
+	uint8_t status = NVM_OK;
+
+	while(1) {
+		flash_sr = FLASH->SR;
+
+		if((flash_sr & (0x32F<<8)) != 0) {		//an error flag is up
+			status = NVM_ErrorFromSR(flash_sr);
+			FLASH->SR = (0x32F<<8);				//we reset all the error flags
+			NVM_LogError(status, flash_sr);
+			break;
+		}
+
+		if(NVM_last_error.irq_pending == 1) {	//the FLASH IRQ has caught the error before us
+			status = NVM_last_error.status;
+			break;
+		}
+
+		if(((flash_sr & (1<<0)) == 0) && (((flash_sr & (1<<1)) == (1<<1)) || (NVM_lowpower.op_done == 1))) break;
+												//BSY is 0 and EOP is 1 (or the FLASH IRQ has seen and cleared EOP), we are done
+
+		if((SysTick->CTRL & (1<<16)) == (1<<16)) elapsed_ms++;
+												//COUNTFLAG is cleared by the read
+		if(elapsed_ms > NVM_TIMEOUT_MS) {
+			status = NVM_ERR_TIMEOUT;
+			NVM_LogError(status, flash_sr);
+			break;
+		}
+
+		if((NVM_lowpower.sleep_on_busy == 1) && (__get_IPSR() == 0)) NVM_SleepWhileBusy();
+	}
+
+	FLASH->SR = (1<<1);							//we reset the EOP flag to 0 by writing 1 to it
+
+#ifdef nvm_telemetry
+	uint32_t busy_cycles = NVM_GetCycles() - wait_start;
+	NVM_telemetry.busy_cycles += busy_cycles;
+	if(busy_cycles > NVM_telemetry.worst_busy_cycles) NVM_telemetry.worst_busy_cycles = busy_cycles;
+#endif
+
+	return status;
+}
+
+__attribute__((section(".RamFunc"))) static uint8_t NVM_RetryAllowed(uint8_t status, uint8_t* attempt) {
+	/**
+	 * Decides if a failed operation should be done again, according to NVM_retry.
+	 * Only the transient errors (timeout, fetch while write) are retried, up to NVM_retry.max_retries times. Before each retry we wait NVM_retry.backoff_ms, doubled on each attempt.
+	 * The backoff is a polling wait on the SysTick COUNTFLAG (1 ms each), so it can be used by the RAM functions and from IRQs.
+	 *
+	 * Returns 1 if the operation should be retried.
+	 **/
+
+	if((status != NVM_ERR_TIMEOUT) && (status != NVM_ERR_FWW)) return 0;
+	if(*attempt >= NVM_retry.max_retries) return 0;
+
+	uint32_t backoff_ms = (uint32_t)NVM_retry.backoff_ms << *attempt;
+	uint32_t elapsed_ms = 0;
+	while(elapsed_ms <= backoff_ms) {
+		if((SysTick->CTRL & (1<<16)) == (1<<16)) elapsed_ms++;
+	}
+
+	(*attempt)++;
+	NVM_retry.retry_cnt++;
+
+	return 1;
+}
+
+static uint8_t NVM_EEPROMWrite(uint32_t eeprom_addr, uint32_t value, uint8_t byte_cnt) {
+	/**
+	 * Writes a byte, a half-word or a word into the data EEPROM.
+	 * The data EEPROM only needs PELOCK to be removed, PRGLOCK is for the FLASH. With FIX (PECR bit 8) at 0, the hardware only erases the target if it has to, so there is no erase step.
+	 * An EEPROM write doesn't use the half page latch, so it can run from FLASH: a fetch during the write only stalls until it is done.
+	 * A value that is already there is not written again, which spares the endurance and the ~3.2 ms.
+	 **/
+
+	uint8_t status;
+	uint8_t attempt = 0;
+
+	if((eeprom_addr < NVM_EEPROM_BASE) || ((eeprom_addr + byte_cnt) > (NVM_EEPROM_BASE + NVM_EEPROM_SIZE))) return NVM_ERR_RANGE;
+	if((eeprom_addr & (byte_cnt - 1)) != 0) return NVM_ERR_PGA;
+												//half-words and words must be aligned to their size
+
+	if(byte_cnt == 1) {
+		if(*(__IO uint8_t*)(eeprom_addr) == (uint8_t)value) return NVM_OK;
+	} else if(byte_cnt == 2) {
+		if(*(__IO uint16_t*)(eeprom_addr) == (uint16_t)value) return NVM_OK;
+	} else {
+		if(*(__IO uint32_t*)(eeprom_addr) == value) return NVM_OK;
+	}
+
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
+	FLASH->PECR &= ~(1<<8);						//FIX is 0, the target is only erased if it is necessary
+
+	do {
+		NVM_WaitArm();
+		if(byte_cnt == 1) {
+			*(__IO uint8_t*)(eeprom_addr) = (uint8_t)value;
+		} else if(byte_cnt == 2) {
+			*(__IO uint16_t*)(eeprom_addr) = (uint16_t)value;
+		} else {
+			*(__IO uint32_t*)(eeprom_addr) = value;
+		}
+
+		status = NVM_WaitDone();				//we wait until BSY is 0 and EOP is 1, then reset EOP
+	} while(NVM_RetryAllowed(status, &attempt));
+												//Note: writing the EEPROM again is always safe, it does its own erase
+
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
+
+	return status;
+}
+
+__attribute__((section(".RamFunc"))) static uint8_t NVM_RwwTarget(uint32_t flash_addr, uint32_t byte_cnt) {
+	/**
+	 * Read-while-write is possible if the whole target is in the other bank than the code, the app and the vector table.
+	 * The code is everything the linker has put into the FLASH region, from __nvm_code_start__ to __nvm_code_end__ (the linker script keeps it in bank 1 and ASSERTs it). The vector table only matters if it is in the FLASH (VTOR).
+	 * The app is __nvm_app_start__ to __nvm_app_end__: APP_API, APP_CONST and both slots. The main loop calls into the running slot and the dispatch table at any time, so a write into their bank would stall it just the same.
+	 * On a single bank part, everything is in bank 1, so this is always 0.
+	 *
+	 * Note: on the L073 memory maps, the app and the NVM data areas share bank 2 and the code is in bank 1, so no target passes. The writes fall back to the RAM writers until the app gets a bank of its own.
+	 **/
+
+	uint8_t target_bank = NVM_BANK_OF(flash_addr);
+	uint32_t code_start_addr = (uint32_t)&__nvm_code_start__;
+	uint32_t code_end_addr = (uint32_t)&__nvm_code_end__;
+	uint32_t app_start_addr = (uint32_t)&__nvm_app_start__;
+	uint32_t app_end_addr = (uint32_t)&__nvm_app_end__;
+	uint32_t vector_addr = SCB->VTOR;
+
+	if(NVM_CFG_DUAL_BANK == 0) return 0;
+	if((target_bank == NVM_BANK_NONE) || (NVM_BANK_OF(flash_addr + byte_cnt - 1) != target_bank)) return 0;
+	if((NVM_BANK_OF(code_start_addr) == target_bank) || (NVM_BANK_OF(code_end_addr - 1) == target_bank)) return 0;
+												//the code can't span both banks, the linker script checks that
+	if((NVM_BANK_OF(app_start_addr) == target_bank) || (NVM_BANK_OF(app_end_addr - 1) == target_bank)) return 0;
+	if(NVM_BANK_OF(vector_addr) == target_bank) return 0;
+	return 1;
+}
+
+__attribute__((section(".RamFunc"))) static uint8_t NVM_IsBlank(uint32_t flash_addr, uint32_t word_cnt) {
+	for(uint32_t i = 0; i < word_cnt; i++) {
+		if(*(__IO uint32_t*)(flash_addr + (i * 4)) != 0) return 0;
+	}
+	return 1;
+}
 
 
 //1)FLASH speed and interrupt initialisation
@@ -28,7 +478,7 @@ void NVM_Init (void){
 	 * Note: the NVM control panel will be closed by even the simplest activity outside this function in order to protect the FLASH from accidental corruption. The control panel must be unlocked to allow FLASH operations!
 	 *
 	 * Function to set NVM functions (FLASH, EEPROM and Option bytes).
-	 * We generally don't need to use this since FLASH is already properly initialised upon startup and we don't use EEPROM.
+	 * We generally don't need to use this since FLASH is already properly initialised upon startup. The data EEPROM needs no initialisation either (see EEPROMUpd_Word).
 	 * Separate NVMs should be interacted with separately in code.
 	 * Note: even though all registers are called FLASH, it is actually NVM and not just FLASH.
 	 * Note: in EEPROM, a page and the word are the same size.
@@ -37,23 +487,30 @@ void NVM_Init (void){
 	 * 2)Set speed and buffers
 	 * 3)Set interrupts
 	 * 4)Close the PELOCK
+	 * 5)Check NVMConfig against the linker script
 	 *
 	 **/
 
 	//1)
-	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
-	FLASH->PEKEYR = 0x02030405;					//PEKEY2
+	FLASH->PEKEYR = NVM_CFG_PEKEY1;				//PEKEY1
+	FLASH->PEKEYR = NVM_CFG_PEKEY2;				//PEKEY2
 												//Note: NVM has a two step enable element to unlock the PECR register and put PELOCK to 0
 
 	//2)
-	//FLASH.ACR register modification comes here when necessary.
-	//It sets up the speed, latency and the preread of the NVMs.
-	//we don't use it
+	if((FLASH->ACR & (1<<0)) == (1<<0)) {		//one wait state (LATENCY), set with the clock in main.c
+		FLASH->ACR &= ~(1<<5);					//the prefetch buffer is used (DISAB_BUF to 0)
+		FLASH->ACR |= (1<<1);					//prefetch enabled (PRFTEN)
+		FLASH->ACR |= (1<<6);					//pre-read enabled (PRE_READ)
+												//Note: pre-read fetches the next 64 bits as soon as a read is done, so sequential (LDM) reads don't wait for the wait state
+	}
+												//Note: with LATENCY 0 (SystemClock_Config runs from the 2.1 MHz MSI) every read is single cycle already and the buffers would only cost current
+												//Note: NVM_Init must therefore be called after SystemClock_Config
 
 
 	//3)
 	FLASH->PECR &= ~(1<<16);					//EOP interrupt disabled (EOPIE)
 												//Note: if we do FLASH writing word by word, this interrupt will be mostly useless.
+												//Note: the asynchronous mode enables it for the time it is running (see NVM_AsyncStart)
 	FLASH->PECR |= (1<<17);						//Error interrupt enabled (ERRIE)
 //	FLASH->PECR |= (1<<23);						//we would enable the NZDISABLE erase check (will only allow writing to FLASH if FLASH has been erased)
 												//on L0xx devices, it doesn't seem to exist
@@ -64,10 +521,17 @@ void NVM_Init (void){
 												//Note: writing 0xCC to the RDPORT puts Level 2 protection, which bricks the micro indefinitely!!!
 	//5)
 	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
+
+	//6)
+	if(NVM_ConfigCheck() != 0) {
+		NVM_LogError(NVM_ERR_CONFIG, 0);
+		Error_Handler();						//we stop here: a write with the wrong geometry could erase the code itself
+	}
+												//Note: the linker script already fails the link on a mismatch, this is a backstop for a script without the ASSERTs
 }
 
 //2)Erase a page of FLASH
-void FLASHErase_Page(uint32_t flash_page_addr) {
+uint8_t FLASHErase_Page(uint32_t flash_page_addr) {
 	/** This function erases a full page of FLASH. A page consists of 8 rows of 4 words (128 bytes or 1 kbit).
 	 * It is not possible to erase a smaller section of FLASH than a page.
 	 *
@@ -81,19 +545,22 @@ void FLASHErase_Page(uint32_t flash_page_addr) {
 	 * 2)Unlock FLASH memory.
 	 * 3)Remove readout protection (if necessary)
 	 * 4)Choose the erase action. Pick the FLASH as the target of the operation.
-	 * 5)Replace the word with the new one and wait until success flag is raised
+	 * 5)Replace the word with the new one and wait until success flag is raised, retry if the policy allows it
 	 * 6)Close NVM and add readout protection
 	 *
+	 * Returns NVM_OK or an NVM_ERR_ code.
+	 *
 	 * Note: writing 0xCC to the RDPORT bricks the micro indefinitely!!!
 	 **/
 
+	uint8_t status;
+	uint8_t attempt = 0;
+
 	//1)
-	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
-	FLASH->PEKEYR = 0x02030405;					//PEKEY2
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
 
 	//2)
-	FLASH->PRGKEYR = 0x8C9DAEBF;				//RRGKEY1
-	FLASH->PRGKEYR = 0x13141516;				//RRGKEY2
+	NVM_UnlockPRG();							//PRGKEY1 and PRGKEY2, skipped if PRGLOCK is already removed (e.g. by an open NVM session)
 
 	//3)
 //	FLASH->OPTR = (0xAA<<0);					//we switch to Level 0 protection using RDPROT bits, if necessary (unless the FLASH protection is changed manually, this should be fine as it is)
@@ -103,26 +570,33 @@ void FLASHErase_Page(uint32_t flash_page_addr) {
 	FLASH->PECR |= (1<<3);						//we pick the FLASH for erasing
 
 	//5)
-	*(__IO uint32_t*)(flash_page_addr) = (uint32_t)0;		//value doesn't actually matter here, we are erasing
+	do {
+		NVM_WaitArm();
+		*(__IO uint32_t*)(flash_page_addr) = (uint32_t)0;	//value doesn't actually matter here, we are erasing
+		NVM_TELEM_ERASE(flash_page_addr);
 
-	while((FLASH->SR & (1<<0)) == (1<<0));		//we stay in the loop while the BSY flag is 1
-
-	while(!(((FLASH->SR & (1<<1)) == (1<<1))));	//we stay in the loop while the EOP flag is not 1
-	FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
+		status = NVM_WaitDone();				//we wait until BSY is 0 and EOP is 1, then reset EOP
+	} while(NVM_RetryAllowed(status, &attempt));
+												//Note: erasing again is always safe
 
 	//6)
+	FLASH->PECR &= ~(1<<9);						//we leave ERASE mode
+	FLASH->PECR &= ~(1<<3);						//we release the FLASH
+												//Note: within an NVM session the PECR stays unlocked, so a following word write would be an erase otherwise
 //	FLASH->OPTR = (0xBB<<0);					//we switch back to Level 1 protection using RDPROT bits
-	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
+
+	return status;
 }
 
 //3)Write a word to a FLASH address
-void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
+uint8_t FLASHUpd_WordOrder(uint32_t flash_word_addr, uint32_t updated_flash_value, uint8_t byte_order) {
 	/** This function writes a 32-bit word in the NVM.
 	 * The code assumes that the target position is already empty. If it is not, the resulting word will be corrupted (a bitwise OR of the original value and the new one).
 	 * On L0xx, there is no NOTZEROERR control to avoid this corruption.
 	 *
 	 * After unlocking the NVM control panel again, we do four things here:
-	 * 1) We so an endian swap on the word we wish to write to the FLASH. This is necessary since the FLASH will do one automatically during the process.
+	 * 1) We do an endian swap on the word we wish to write to the FLASH, if "byte_order" asks for it (NVM_BYTE_ORDER_SWAP).
 	 * 2) We choose the FLASH memory as our workspace by unlocking it. We don't need to specify anything in the control panel. Of note, neither the FLASH address nor the data will be incremented automatically here.
 	 * 2) We choose the address we want to write to and then wait for the writing to be done. __IO is again a macro for "volatile".
 	 * 4) We reset the flags and close the NVM control panel.
@@ -138,26 +612,27 @@ void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
 	 * 			Note: if NOTZEROERR flag/interrupt is active, only if the target is empty are we allowed to write there.
 	 * 6)Close NVM and add readout protection
 	 *
+	 * Returns NVM_OK or an NVM_ERR_ code. A failed write is only retried if the target word is still blank.
+	 *
 	 * Note: writing is a bitwise "OR" operation. Target must be erased first (see FLASHErase_Page function).
 	 * Note: the arriving byte sequence is LSB byte first, not MSB byte first. The machine code within the micro is flipped compared to what is loaded into it.
 	 * Note: writing 0xCC to the RDPORT bricks the micro indefinitely!!!
 	 **/
 
+	uint8_t status;
+	uint8_t attempt = 0;
+
 	//1)
-#ifdef endian_swap
-	uint32_t swapped_updated_flash_value = ((updated_flash_value >> 24) & 0xff) | 		// move byte 3 to byte 0
-	                    ((updated_flash_value << 8) & 0xff0000) | 						// move byte 1 to byte 2
-	                    ((updated_flash_value >> 8) & 0xff00) | 						// move byte 2 to byte 1
-	                    ((updated_flash_value << 24) & 0xff000000); 					// byte 0 to byte 3
-#endif
+	if(byte_order == NVM_BYTE_ORDER_SWAP) {
+		updated_flash_value = __REV(updated_flash_value);
+												//REV is a single cycle instruction, it replaces the four shift/mask operations
+	}
 
 	//2)
-	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
-	FLASH->PEKEYR = 0x02030405;					//PEKEY2
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
 
 	//3)
-	FLASH->PRGKEYR = 0x8C9DAEBF;				//RRGKEY1
-	FLASH->PRGKEYR = 0x13141516;				//RRGKEY2
+	NVM_UnlockPRG();							//PRGKEY1 and PRGKEY2, skipped if PRGLOCK is already removed (e.g. by an open NVM session)
 												//Note: FLASH has a two step enable element to unlock writing to the FLASH
 												//Note: PRGLOCK bits being 0 is a precondition for writing to FLASH
 												//Note: PELOCK is already removed in step 1), using the PEKEY
@@ -167,33 +642,38 @@ void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
 												//in-application FLASH should be modified at Level1 readout protection, so likley no need to change that
 
 	//5)
-	*(__IO uint32_t*)(flash_word_addr) = updated_flash_value;
-
-#ifdef endian_swap
-	//*(__IO uint32_t*)(flash_word_addr) = swapped_updated_flash_value;
-#endif
+	do {
+		NVM_WaitArm();
+		*(__IO uint32_t*)(flash_word_addr) = updated_flash_value;
+		NVM_TELEM_WORD();
 
 												//Note: the target area must be erased before writing to it, otherwise data gets corrupted
 
-	while((FLASH->SR & (1<<0)) == (1<<0));		//we stay in the loop while the BSY flag is 1
-	while(!(((FLASH->SR & (1<<1)) == (1<<1))));	//we stay in the loop while the EOP flag is not 1
-	FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
+		status = NVM_WaitDone();				//we wait until BSY is 0 and EOP is 1, then reset EOP
+	} while((status != NVM_OK) && NVM_IsBlank(flash_word_addr, 1) && NVM_RetryAllowed(status, &attempt));
+
+#ifdef nvm_verify
+	if((status == NVM_OK) && (*(__IO uint32_t*)(flash_word_addr) != updated_flash_value)) status = NVM_ERR_VERIFY;
+												//a single word is compared directly, the CRC would only be slower
+#endif
 
 	//6)
 //	FLASH->OPTR = (0xBB<<0);					//we switch back to Level 1 protection using RDPROT bits
-	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
+
+	return status;
 }
 
 
 
 
 //4)Write a half-page to a FLASH address
-void FLASHUpd_HalfPage(uint32_t flash_half_page_addr) {
+uint8_t FLASHUpd_HalfPage(uint32_t flash_half_page_addr) {
 	/**
 	 * The function MUST run in RAM, not in FLASH!!!!!!
 	 * Call with the __RAM_FUNC attribute!!!!!
 	 *
-	 * Also, ALL IRQs must be disabled during the write process or we have a crash.
+	 * Also, ALL IRQs must be disabled while the half-page latch is loaded or we have a crash.
 	 * 
 	 *
 	 * This function writes a sixteen 32-bit words in the NVM.
@@ -216,11 +696,15 @@ void FLASHUpd_HalfPage(uint32_t flash_half_page_addr) {
 	 * 3)Remove readout protection (if necessary)
 	 * 4)We pick FLASH programming at half-page.
 	 * 5)Disable IRQs
-	 * 6)Replace the word with the new one and wait until success flag is raised
+	 * 6)Load the 16 words into the latch, enable IRQs and wait until success flag is raised
 	 * 			Note: NOTZEROERR flag/interrupt may not be available on certain devices, meaning that data will be written to a target independent of what is already there.
 	 * 			Note: if NOTZEROERR flag/interrupt is active, only if the target is empty are we allowed to write there.
 	 * 7)Close NVM and add readout protection
-	 * 8)Enable IRQs
+	 *
+	 * Note: the IRQs are only masked while the latch is being loaded. Once the 16 words are in, an IRQ that reads the FLASH just stalls until the programming is done, it doesn't abort it.
+	 * Note: the length of the masked window is stored in NVM_irq_window.
+	 *
+	 * Returns NVM_OK or an NVM_ERR_ code. A failed burst is only retried if the half page is still blank.
 	 *
 	 * Note: writing is a bitwise "OR" operation. Target must be erased first (see FLASHErase_Page function).
 	 * Note: the arriving byte sequence is LSB byte first, not MSB byte first. The machine code within the micro is flipped compared to what is loaded into it.
@@ -228,12 +712,10 @@ void FLASHUpd_HalfPage(uint32_t flash_half_page_addr) {
 	 **/
 
 	//1)
-	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
-	FLASH->PEKEYR = 0x02030405;					//PEKEY2
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
 
 	//2)
-	FLASH->PRGKEYR = 0x8C9DAEBF;				//RRGKEY1
-	FLASH->PRGKEYR = 0x13141516;				//RRGKEY2
+	NVM_UnlockPRG();							//PRGKEY1 and PRGKEY2, skipped if PRGLOCK is already removed (e.g. by an open NVM session)
 												//Note: FLASH has a two step enable element to unlock writing to the FLASH
 												//Note: PRGLOCK bits being 0 is a precondition for writing to FLASH
 												//Note: PELOCK is already removed in step 1), using the PEKEY
@@ -247,48 +729,207 @@ void FLASHUpd_HalfPage(uint32_t flash_half_page_addr) {
 	FLASH->PECR |= (1<<10);						//we pick the half-page programming mode (FPPRG)
 
 
-	//5)
-	__disable_irq();							//we disable all the IRQs
+	uint8_t status;
+	uint8_t attempt = 0;
+
+	do {
+		NVM_WaitArm();
+		//5)
+		uint32_t primask;
+		uint32_t window_start = NVM_IrqWindowOpen(&primask);
+												//we disable all the IRQs
 												//Note: apparently this was "forgotten" in the refman, but one must deactivate all IRQs before working with FLASH, otherwise the writing will be interrupted
 												//Note: it actually makes complete sense...a pickle it is not mentioned whatsoever
 
-	//6)
-	for(uint8_t i = 0; i < 16; i++) {
-		*(__IO uint32_t*)(flash_half_page_addr) = Data_buf[i];
+		//6)
+		for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+			*(__IO uint32_t*)(flash_half_page_addr) = Data_buf[i];
 												//Note: the half page address does not need to be changed (similar to the erasing command)
 												//Note: we only need to step the pointer for the data we want to write into the FLASH
-	}
+		}
 
-	while((FLASH->SR & (1<<0)) == (1<<0));		//we stay in the loop while the BSY flag is 1
-	while(!(((FLASH->SR & (1<<1)) == (1<<1))));	//we stay in the loop while the EOP flag is not 1
+		NVM_IrqWindowClose(primask, window_start);	//the latch is loaded, we re-enable the IRQs
+		NVM_TELEM_HALF_PAGE();
+
+		status = NVM_WaitDone();				//we wait until BSY is 0 and EOP is 1, then reset EOP
 												//EOP will go HIGH only after the 16 words have been copied properly
-	FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
+	} while((status != NVM_OK) && NVM_IsBlank(flash_half_page_addr, NVM_CFG_HALF_PAGE_WORDS) && NVM_RetryAllowed(status, &attempt));
+
+#ifdef nvm_verify
+	if(status == NVM_OK) status = FLASHVerify(flash_half_page_addr, Data_buf, NVM_CFG_HALF_PAGE_WORDS);
+#endif
 
 	//7)
 	FLASH->PECR &= ~(1<<3);						//we disable the FLASH for programming
 	FLASH->PECR &= ~(1<<10);					//we disable the half-page programming mode
-	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
 
-	//8)
-	__enable_irq();								//we re-enable the IRQs
+	return status;
+}
+
+
+
+
+//5)Write consecutive half-pages to FLASH from a RAM buffer
+uint8_t FLASHUpd_HalfPageStreamOrder(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order) {
+	/**
+	 * The function MUST run in RAM, not in FLASH!!!!!!
+	 *
+	 * This is the streaming version of FLASHUpd_HalfPage. It writes "word_cnt" 32-bit words from "src_ptr" to FLASH, starting at "flash_half_page_addr" and moving on to the next half page every 16 words.
+	 * Unlike FLASHUpd_HalfPage, the NVM is unlocked only once at the start and locked only once at the end, independent of how many half pages we write.
+	 * Also, the data is taken directly from the source pointer, so there is no need to copy every chunk into Data_buf before the write.
+	 *
+	 * The start address must align to a half page - first 6 bits of the address must be 0.
+	 * The target area must be erased before calling the function (see FLASHErase_Page).
+	 * If word_cnt is not a multiple of 16, the words of the last, incomplete half page are written one-by-one.
+	 * With "byte_order" NVM_BYTE_ORDER_SWAP, every word is swapped with REV on its way into the latch. The source buffer is not changed.
+	 *
+	 * IRQs are disabled for each latch load separately and re-enabled while the burst is programmed. This way a long image does not block the rest of the system for its entire length.
+	 *
+	 * 1)Unlock the NVM control register PECR.
+	 * 2)Unlock FLASH memory.
+	 * 3)We pick FLASH programming at half-page.
+	 * 4)Write the full half pages one after the other: disable IRQs, load the 16 words, enable IRQs, wait until success flag is raised
+	 * 5)Leave half-page mode and write the remaining words, if any
+	 * 6)Close NVM
+	 *
+	 * Returns NVM_OK or the NVM_ERR_ code of the first burst/word that failed (after the retries). The stream stops at the first failure.
+	 *
+	 * Note: the source buffer MUST be in RAM. Reading the FLASH while the half-page latch is being loaded aborts the burst.
+	 * Note: writing is a bitwise "OR" operation. Target must be erased first (see FLASHErase_Page function).
+	 **/
+
+	uint32_t half_page_cnt = word_cnt / NVM_CFG_HALF_PAGE_WORDS;
+	uint32_t remaining_word_cnt = word_cnt % NVM_CFG_HALF_PAGE_WORDS;
+	uint8_t status = NVM_OK;
+	uint8_t attempt;
+#ifdef nvm_verify
+	uint32_t* verify_src_ptr = src_ptr;
+	uint32_t verify_flash_addr = flash_half_page_addr;
+#endif
+
+	//1)
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
+
+	//2)
+	NVM_UnlockPRG();							//PRGKEY1 and PRGKEY2, skipped if PRGLOCK is already removed (e.g. by an open NVM session)
+
+	//3)
+	FLASH->PECR &= ~(1<<9);						//we make sure we are not in ERASE mode
+	FLASH->PECR |= (1<<3);						//we pick the FLASH for programming (PRG)
+	FLASH->PECR |= (1<<10);						//we pick the half-page programming mode (FPPRG)
+
+	//4)
+	for(uint32_t j = 0; (j < half_page_cnt) && (status == NVM_OK); j++) {
+
+		attempt = 0;
+
+		do {
+			NVM_WaitArm();
+			uint32_t primask;
+			uint32_t window_start = NVM_IrqWindowOpen(&primask);
+												//we disable all the IRQs for the duration of the latch load
+
+			if(byte_order == NVM_BYTE_ORDER_SWAP) {
+				for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+					*(__IO uint32_t*)(flash_half_page_addr) = __REV(src_ptr[i]);
+				}
+			} else {
+				for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+					*(__IO uint32_t*)(flash_half_page_addr) = src_ptr[i];
+												//Note: the half page address does not need to be changed within a burst
+				}
+			}							//Note: two loops, so the byte order is not checked for every word within the masked window
+
+			NVM_IrqWindowClose(primask, window_start);
+												//we re-enable the IRQs while the burst is being programmed
+			NVM_TELEM_HALF_PAGE();
+
+			status = NVM_WaitDone();			//we wait until BSY is 0 and EOP is 1, then reset EOP
+		} while((status != NVM_OK) && NVM_IsBlank(flash_half_page_addr, NVM_CFG_HALF_PAGE_WORDS) && NVM_RetryAllowed(status, &attempt));
+
+		src_ptr = src_ptr + NVM_CFG_HALF_PAGE_WORDS;
+		flash_half_page_addr = flash_half_page_addr + NVM_CFG_HALF_PAGE_BYTES;
+												//we step to the next half page
+	}
+
+	//5)
+	FLASH->PECR &= ~(1<<3);						//we disable the FLASH for programming
+	FLASH->PECR &= ~(1<<10);					//we disable the half-page programming mode
+												//Note: with both PRG and FPRG at 0, a write to FLASH is a simple word write
+
+	for(uint32_t i = 0; (i < remaining_word_cnt) && (status == NVM_OK); i++) {
+		attempt = 0;
+
+		do {
+			NVM_WaitArm();
+			*(__IO uint32_t*)(flash_half_page_addr) = (byte_order == NVM_BYTE_ORDER_SWAP) ? __REV(*src_ptr) : *src_ptr;
+			NVM_TELEM_WORD();
+			status = NVM_WaitDone();			//we wait until BSY is 0 and EOP is 1, then reset EOP
+		} while((status != NVM_OK) && NVM_IsBlank(flash_half_page_addr, 1) && NVM_RetryAllowed(status, &attempt));
+
+		src_ptr++;
+		flash_half_page_addr = flash_half_page_addr + 4;
+	}
+
+#ifdef nvm_verify
+	if((status == NVM_OK) && (byte_order == NVM_BYTE_ORDER_NATIVE)) {
+		status = FLASHVerify(verify_flash_addr, verify_src_ptr, word_cnt);
+												//the whole stream is checked in one pass at the end
+	} else if((status == NVM_OK) && (byte_order == NVM_BYTE_ORDER_SWAP)) {
+		for(uint32_t i = 0; (i < word_cnt) && (status == NVM_OK); i++) {
+			if(*(__IO uint32_t*)(verify_flash_addr + (i * 4)) != __REV(verify_src_ptr[i])) status = NVM_ERR_VERIFY;
+		}								//the CRC peripheral can't swap bytes, so a swapped stream is compared word by word
+	}
+#endif
+
+	//6)
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
+
+	return status;
 }
 
 
 
 
-//5)
-//if we encounter an error during writing to the FLASH, the code stops working
+//6)
+//if we encounter an error during writing to the FLASH, the error is logged and the operation is abandoned
 void FLASH_IRQHandler(void){
 	/**
-	* Simple IRQ to detect errors. We only have errors to trigger the IRQ.
+	* Simple IRQ to detect errors. Errors always trigger the IRQ.
+	* The error is logged into NVM_last_error and the flags are cleared. A blocking primitive waiting for the operation picks it up through NVM_last_error.irq_pending.
+	* If the asynchronous mode is running, the rest of the queue is dropped and the callback is called with the error code.
+	* The EOP flag only triggers the IRQ when the asynchronous mode is running (see NVM_AsyncStart). Then the IRQ moves the queue on to the next operation.
+	* In low power mode, EOP always triggers the IRQ. Outside the asynchronous mode, it only wakes up the blocking primitive sleeping in NVM_WaitDone.
+	*
+	* Note: the code used to stop here in a while(1). One failed write shouldn't halt the whole device though, the caller decides what to do.
 	**/
-	printf("Memory error... \r\n");
-	FLASH->SR |= (0x32F<<8);						//we reset all the error interrupt flags
-	while(1);
+	uint32_t flash_sr = FLASH->SR;
+
+	if((flash_sr & (0x32F<<8)) != 0) {
+		uint8_t status = NVM_ErrorFromSR(flash_sr);
+		FLASH->SR = (0x32F<<8);						//we reset all the error interrupt flags
+		NVM_LogError(status, flash_sr);
+		NVM_last_error.irq_pending = 1;
+
+		if(NVM_async.busy == 1) {
+			FLASH->SR = (1<<1);						//we reset the EOP flag, in case it is up too
+			NVM_AsyncAbort(status);
+		}
+		return;
+	}
+
+	if(((FLASH->SR & (1<<1)) == (1<<1)) && (NVM_async.busy == 1)) {
+		FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
+		NVM_AsyncStep();
+	} else if((FLASH->SR & (1<<1)) == (1<<1)) {
+		FLASH->SR = (1<<1);							//EOP must be cleared, otherwise the IRQ fires again straight away
+		NVM_lowpower.op_done = 1;
+	}
 }
 
 
-//6)FLASH IRQ priority
+//7)FLASH IRQ priority
 	/**
 	* Priority assignemnt for the IRQ.
 	**/
@@ -296,3 +937,1201 @@ void FLASHIRQPriorEnable(void) {
 	NVIC_SetPriority(FLASH_IRQn, 1);
 	NVIC_EnableIRQ(FLASH_IRQn);
 }
+
+
+
+//8)Open an NVM session
+void NVM_SessionBegin(void) {
+	/**
+	 * This function unlocks PECR and FLASH programming once and keeps them unlocked until NVM_SessionEnd is called.
+	 * While the session is open, FLASHErase_Page, FLASHUpd_Word, FLASHUpd_HalfPage and FLASHUpd_HalfPageStream don't write the keys and don't set PELOCK at their end.
+	 * Sessions can be nested: only the outermost NVM_SessionEnd locks the NVM again.
+	 *
+	 * 1)Unlock PECR and FLASH, if they are locked
+	 * 2)Track the session
+	 *
+	 * Note: an open session leaves the FLASH unprotected against accidental writes. Keep sessions as short as the batch they serve.
+	 **/
+
+	//1)
+	NVM_UnlockPECR();
+	NVM_UnlockPRG();
+
+	//2)
+	NVM_session.depth++;
+	NVM_session.unlocked = 1;
+}
+
+
+//9)Close an NVM session
+void NVM_SessionEnd(void) {
+	/**
+	 * Closes the session opened by NVM_SessionBegin. The NVM is locked once the outermost session is closed.
+	 *
+	 * 1)Track the session
+	 * 2)Lock the NVM
+	 **/
+
+	//1)
+	if(NVM_session.depth == 0) return;			//unbalanced call, nothing to close
+	NVM_session.depth--;
+
+	//2)
+	if(NVM_session.depth == 0) {
+		NVM_Lock();
+		NVM_session.unlocked = 0;
+	}
+}
+
+
+
+//10)Queue an asynchronous operation
+uint8_t NVM_AsyncQueue(uint8_t op_type, uint32_t flash_addr, uint32_t value, uint32_t* src_ptr) {
+	/**
+	 * This function adds an erase or program operation to the queue of the asynchronous mode.
+	 * Nothing is written to the NVM here, the queue is only executed once NVM_AsyncStart is called.
+	 *
+	 * op_type is NVM_OP_ERASE_PAGE, NVM_OP_WORD or NVM_OP_HALF_PAGE.
+	 * value is the word to write for NVM_OP_WORD, src_ptr is the 16 word source for NVM_OP_HALF_PAGE. The unused one is ignored.
+	 * Same rules apply as for the blocking primitives: erase addresses are aligned to a page, half-page addresses to a half-page, targets must be erased before programming.
+	 *
+	 * Returns 1 if the operation was queued, 0 if the queue is full or is being executed.
+	 *
+	 * Note: the source of a half-page operation MUST be in RAM and MUST remain untouched until the completion callback is called. The driver only stores the pointer.
+	 **/
+
+	if((NVM_async.busy == 1) || (NVM_async.count == NVM_ASYNC_QUEUE_LEN)) return 0;
+
+	NVM_async.queue[NVM_async.tail].op_type = op_type;
+	NVM_async.queue[NVM_async.tail].flash_addr = flash_addr;
+	NVM_async.queue[NVM_async.tail].value = value;
+	NVM_async.queue[NVM_async.tail].src_ptr = src_ptr;
+
+	NVM_async.tail = (NVM_async.tail + 1) % NVM_ASYNC_QUEUE_LEN;
+	NVM_async.count++;
+
+	return 1;
+}
+
+
+//11)Start the asynchronous queue
+uint8_t NVM_AsyncStart(void (*callback)(uint8_t status)) {
+	/**
+	 * This function starts the first queued operation and returns straight away. The rest of the queue is executed from the FLASH_IRQHandler, each time the EOP flag is raised.
+	 * At the end of the queue, the callback is called with a status of 0. The callback is called from the FLASH IRQ, so it should be kept short.
+	 *
+	 * The whole queue runs within one NVM session, so the keys are written only once.
+	 * The FLASH IRQ must be enabled (see FLASHIRQPriorEnable) for the mode to work.
+	 *
+	 * 1)Check that we have something to do
+	 * 2)Open the session and enable the EOP interrupt
+	 * 3)Launch the first operation
+	 *
+	 * Note: the blocking primitives must not be used while NVM_AsyncBusy() returns 1.
+	 * Note: on a single bank device such as the L053, reading the FLASH while it is busy stalls the bus until the operation is done. To actually do useful work in parallel, that work must run from RAM (or read the data EEPROM/other bank). What we gain either way is that the core is not stuck in a polling loop between operations.
+	 **/
+
+	//1)
+	if((NVM_async.busy == 1) || (NVM_async.count == 0)) return 0;
+
+	//2)
+	NVM_async.busy = 1;
+	NVM_async.callback = callback;
+	NVM_SessionBegin();
+	FLASH->PECR |= (1<<16);						//EOP interrupt enabled (EOPIE)
+
+	//3)
+	NVM_AsyncLaunch(&NVM_async.queue[NVM_async.head]);
+
+	return 1;
+}
+
+
+//12)Check the asynchronous queue
+uint8_t NVM_AsyncBusy(void) {
+	return NVM_async.busy;
+}
+
+
+//13)Launch one asynchronous operation
+void NVM_AsyncLaunch(NVM_AsyncOp_TypeDef* op) {
+	/**
+	 * The function MUST run in RAM, not in FLASH!!!!!!
+	 *
+	 * Sets up the PECR for the operation type and triggers it. We don't wait for anything here, the EOP interrupt will tell us when the operation is done.
+	 * For half pages, the IRQs are only disabled while the latch is loaded.
+	 **/
+
+	FLASH->PECR &= ~((1<<3) | (1<<9) | (1<<10));	//we clear PROG, ERASE and FPRG to start from simple word programming
+
+	switch(op->op_type) {
+		case NVM_OP_ERASE_PAGE:
+			FLASH->PECR |= (1<<9);				//we ERASE
+			FLASH->PECR |= (1<<3);				//we pick the FLASH for erasing
+			*(__IO uint32_t*)(op->flash_addr) = (uint32_t)0;
+			NVM_TELEM_ERASE(op->flash_addr);
+			break;
+
+		case NVM_OP_WORD:
+			*(__IO uint32_t*)(op->flash_addr) = op->value;
+			NVM_TELEM_WORD();
+			break;
+
+		case NVM_OP_HALF_PAGE:
+			FLASH->PECR |= (1<<3);				//we pick the FLASH for programming (PRG)
+			FLASH->PECR |= (1<<10);				//we pick the half-page programming mode (FPPRG)
+			if(NVM_RwwTarget(op->flash_addr, NVM_CFG_HALF_PAGE_BYTES) == 1) {
+				for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+					*(__IO uint32_t*)(op->flash_addr) = op->src_ptr[i];
+				}								//the other bank is written, an IRQ fetching from ours can't abort the burst
+				NVM_TELEM_HALF_PAGE();
+			} else {
+				uint32_t primask;
+				uint32_t window_start = NVM_IrqWindowOpen(&primask);
+				for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+					*(__IO uint32_t*)(op->flash_addr) = op->src_ptr[i];
+				}
+				NVM_IrqWindowClose(primask, window_start);
+				NVM_TELEM_HALF_PAGE();
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+//14)Step the asynchronous queue
+static void NVM_AsyncStep(void) {
+	/**
+	 * Called from the FLASH IRQ when an operation has finished. We drop the finished operation and either launch the next one or close the queue and call the callback.
+	 *
+	 * 1)Remove the finished operation from the queue
+	 * 2)Launch the next one, if any
+	 * 3)Otherwise, disable EOPIE, close the session and report back
+	 **/
+
+	//1)
+	NVM_async.head = (NVM_async.head + 1) % NVM_ASYNC_QUEUE_LEN;
+	NVM_async.count--;
+
+	//2)
+	if(NVM_async.count != 0) {
+		NVM_AsyncLaunch(&NVM_async.queue[NVM_async.head]);
+		return;
+	}
+
+	//3)
+	FLASH->PECR &= ~((1<<3) | (1<<9) | (1<<10));	//we leave any programming/erasing mode
+	if(NVM_lowpower.sleep_on_busy == 0) FLASH->PECR &= ~(1<<16);
+												//EOP interrupt disabled (EOPIE), unless the low power mode needs it
+	NVM_SessionEnd();
+	NVM_async.busy = 0;
+
+	if(NVM_async.callback != 0) NVM_async.callback(NVM_OK);
+}
+
+
+
+//15)Check if a page of FLASH is erased
+uint8_t FLASHPage_IsBlank(uint32_t flash_page_addr) {
+	/**
+	 * On L0xx, an erased FLASH word reads as 0. This function scans the 32 words of a page and returns 1 if all of them are 0.
+	 * The scan stops at the first block of four words that is not zero, so a page with data is usually detected after a few reads.
+	 *
+	 * The address is aligned down to the start of its page.
+	 **/
+
+	const uint32_t* page_ptr = (const uint32_t*)(flash_page_addr & ~(uint32_t)NVM_CFG_PAGE_MASK);
+
+	return (NVM_WordScan(page_ptr, NVM_CFG_PAGE_WORDS, 0) == NVM_CFG_PAGE_WORDS) ? 1 : 0;
+}
+
+
+//16)Erase a range of FLASH pages
+uint32_t FLASHErase_Range(uint32_t flash_start_addr, uint32_t length) {
+	/**
+	 * This function erases every page that overlaps with the "length" bytes starting at "flash_start_addr".
+	 * Pages that are already blank are skipped. The rest is erased within one NVM session, so the unlock sequence is run only once for the whole range.
+	 *
+	 * Returns the number of pages that have actually been erased. The erase stops at the first page that fails, its error is in NVM_last_error.
+	 *
+	 * 1)Align the range to full pages
+	 * 2)Open the session
+	 * 3)Check and erase the pages one-by-one
+	 * 4)Close the session
+	 **/
+
+	//1)
+	uint32_t flash_page_addr = flash_start_addr & ~(uint32_t)NVM_CFG_PAGE_MASK;
+	uint32_t flash_end_addr = flash_start_addr + length;
+	uint32_t erased_page_cnt = 0;
+
+	if(length == 0) return 0;
+
+	//2)
+	NVM_SessionBegin();
+
+	//3)
+	while(flash_page_addr < flash_end_addr) {
+		if(FLASHPage_IsBlank(flash_page_addr) == 0) {
+			if(FLASHErase_Page(flash_page_addr) != NVM_OK) break;
+			erased_page_cnt++;
+		}
+		flash_page_addr = flash_page_addr + NVM_CFG_PAGE_BYTES;
+	}
+
+	//4)
+	NVM_SessionEnd();
+
+	return erased_page_cnt;
+}
+
+
+
+//17)Update a FLASH area by rewriting only the pages that differ
+uint8_t FLASHUpd_Delta(uint32_t* src_ptr, uint32_t flash_addr, uint32_t word_cnt) {
+	/**
+	 * This function writes "word_cnt" words from "src_ptr" to "flash_addr", but only touches the FLASH where the new data is different from what is already there.
+	 * The area does not need to be erased beforehand and does not need to be aligned to a page: the words of the page outside the area are kept.
+	 *
+	 * For each page the area touches, we:
+	 * - merge the current FLASH content and the new data in a page buffer in RAM,
+	 * - compare the buffer with the FLASH half page by half page,
+	 * - skip the page if nothing changed,
+	 * - write only the changed words if each one of them is erased in the FLASH (0 on L0xx), so no erase is needed,
+	 * - erase the page and write back only the half pages that are not blank otherwise.
+	 *
+	 * Returns NVM_OK or the NVM_ERR_ code of the first erase/write that fails. The update stops there, the pages after it are not touched.
+	 *
+	 * 1)Open the session
+	 * 2)Skip the page if the new data is already there, build the merged page in RAM otherwise
+	 * 3)Compare it with the FLASH
+	 * 4)Write the difference
+	 * 5)Step to the next page and close the session at the end
+	 *
+	 * Note: src_ptr can be a FLASH address here, since the data is copied into the RAM page buffer before any writing.
+	 * Note: the new data is compared with the page first, so a page that doesn't change is never copied into the page buffer.
+	 * Note: the words are expected in the same endian as for FLASHUpd_HalfPage.
+	 **/
+
+	uint32_t flash_end_addr = flash_addr + (word_cnt * 4);
+	uint32_t flash_page_addr = flash_addr & ~(uint32_t)NVM_CFG_PAGE_MASK;
+	uint8_t status = NVM_OK;
+
+	//1)
+	NVM_SessionBegin();
+
+	while((flash_page_addr < flash_end_addr) && (status == NVM_OK)) {
+
+		uint32_t* flash_page_ptr = (uint32_t*)flash_page_addr;
+		uint8_t changed_half_pages = 0;				//bit 0 for the first half page, bit 1 for the second
+		uint8_t erase_needed = 0;
+		uint32_t part_start_addr = (flash_page_addr > flash_addr) ? flash_page_addr : flash_addr;
+		uint32_t part_end_addr = ((flash_page_addr + NVM_CFG_PAGE_BYTES) < flash_end_addr) ? (flash_page_addr + NVM_CFG_PAGE_BYTES) : flash_end_addr;
+		uint32_t part_word_cnt = (part_end_addr - part_start_addr) / 4;
+
+		//2)
+		if(NVM_WordCompare(&src_ptr[(part_start_addr - flash_addr) / 4], (const uint32_t*)part_start_addr, part_word_cnt) == part_word_cnt) {
+			flash_page_addr = flash_page_addr + NVM_CFG_PAGE_BYTES;
+			continue;
+		}										//the part of the page we update is already in the FLASH, nothing to merge
+
+		for(uint8_t i = 0; i < NVM_CFG_PAGE_WORDS; i++) {
+			uint32_t word_addr = flash_page_addr + (i * 4);
+			if((word_addr >= flash_addr) && (word_addr < flash_end_addr)) {
+				NVM_page_buf[i] = src_ptr[(word_addr - flash_addr) / 4];
+			} else {
+				NVM_page_buf[i] = flash_page_ptr[i];
+			}
+		}
+
+		//3)
+		for(uint8_t i = 0; i < NVM_CFG_PAGE_WORDS; i++) {
+			if(NVM_page_buf[i] != flash_page_ptr[i]) {
+				changed_half_pages |= (1 << (i / NVM_CFG_HALF_PAGE_WORDS));
+				if(flash_page_ptr[i] != 0) erase_needed = 1;
+												//Note: a word that is not erased can't be written without erasing the whole page
+			}
+		}
+
+		//4)
+		if(changed_half_pages == 0) {
+			//nothing to do on this page
+		} else if(erase_needed == 0) {
+			for(uint8_t i = 0; (i < NVM_CFG_PAGE_WORDS) && (status == NVM_OK); i++) {
+				if(NVM_page_buf[i] != flash_page_ptr[i]) {
+					status = FLASHUpd_Word(flash_page_addr + (i * 4), NVM_page_buf[i]);
+				}
+			}
+		} else {
+			status = FLASHErase_Page(flash_page_addr);
+			for(uint8_t h = 0; (h < 2) && (status == NVM_OK); h++) {
+				uint8_t half_page_blank = 1;
+				for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+					if(NVM_page_buf[(h * NVM_CFG_HALF_PAGE_WORDS) + i] != 0) half_page_blank = 0;
+				}
+				if(half_page_blank == 0) {
+					status = FLASHUpd_HalfPageStreamBank(&NVM_page_buf[h * NVM_CFG_HALF_PAGE_WORDS], flash_page_addr + (h * NVM_CFG_HALF_PAGE_BYTES), NVM_CFG_HALF_PAGE_WORDS);
+				}						//Note: a blank half page is already in the erased state, we don't need to write it
+			}
+		}
+
+		//5)
+		flash_page_addr = flash_page_addr + NVM_CFG_PAGE_BYTES;
+	}
+
+	NVM_SessionEnd();
+
+	return status;
+}
+
+
+
+//18)Write a half-page to FLASH using DMA
+uint8_t FLASHUpd_HalfPageDMA(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint8_t prio_threshold) {
+	/**
+	 * The function MUST run in RAM, not in FLASH!!!!!!
+	 *
+	 * This is the DMA version of FLASHUpd_HalfPage. The 16 words are moved from "src_ptr" into the half-page latch by DMA1 channel 1 in memory-to-memory mode instead of a CPU loop.
+	 * The IRQs are only masked while the latch is being loaded and only those with a priority value equal or above "prio_threshold" (i.e. equally or less important). The more important IRQs remain active.
+	 * With "prio_threshold" 0 all IRQs are masked, like in FLASHUpd_HalfPage.
+	 * Once the DMA is done, all IRQs are restored and we only poll BSY/EOP, which does not need any masking.
+	 *
+	 * Input is the RAM buffer, the half-page aligned FLASH address - first 6 bits must be 0 - and the priority threshold.
+	 * The target half page must be erased before calling the function (see FLASHErase_Page).
+	 *
+	 * 1)Unlock the NVM control register PECR and the FLASH.
+	 * 2)We pick FLASH programming at half-page.
+	 * 3)Set up the DMA
+	 * 4)Mask the IRQs below the threshold
+	 * 5)Run the DMA and wait until it is done
+	 * 6)Restore the IRQs
+	 * 7)Wait until the programming is finished
+	 * 8)Close NVM
+	 *
+	 * Note: the Cortex-M0+ has no BASEPRI, so the masking is done by disabling the IRQs one-by-one in the NVIC and then enabling them again.
+	 * Note: SysTick and PendSV are system exceptions, the NVIC enable bits don't cover them. SysTick is gated with TICKINT if its priority is at or below the threshold. A tick that comes in meanwhile is pended once the window is over, so the HAL tick doesn't lose it.
+	 * 	 PendSV (and SVCall) can't be gated. With a threshold, nothing may trigger them during the call, or their handlers must be in RAM.
+	 * Note: an IRQ left active must not touch the FLASH while the latch is being loaded. This means that its handler AND the vector table must be in RAM (see SCB->VTOR). Otherwise the fetch aborts the burst.
+	 * Returns NVM_OK or an NVM_ERR_ code. There are no retries here, the caller should erase the half page and try again.
+	 *
+	 * Note: the DMA is only faster in freeing the IRQs. The 16 word bus transfers take about the same time as the CPU loop.
+	 **/
+
+	uint32_t irq_mask = 0;
+	uint32_t primask = 0;
+	uint32_t window_start = 0;
+	uint8_t systick_gated = 0;
+	uint8_t status;
+
+	//1)
+	NVM_UnlockPECR();							//PEKEY1 and PEKEY2, skipped if PECR is already unlocked (e.g. by an open NVM session)
+	NVM_UnlockPRG();							//PRGKEY1 and PRGKEY2, skipped if PRGLOCK is already removed (e.g. by an open NVM session)
+
+	//2)
+	FLASH->PECR &= ~(1<<9);						//we make sure we are not in ERASE mode
+	FLASH->PECR |= (1<<3);						//we pick the FLASH for programming (PRG)
+	FLASH->PECR |= (1<<10);						//we pick the half-page programming mode (FPPRG)
+
+	//3)
+	RCC->AHBENR |= (1<<0);						//DMA clock enabled
+	DMA1_Channel1->CCR = 0;						//channel disabled and reset
+	DMA1->IFCR = (1<<0);						//we clear all the flags of channel 1
+	DMA1_Channel1->CPAR = flash_half_page_addr;	//the destination is the half page address
+												//Note: the address does not need to be changed within a burst, so PINC stays 0
+	DMA1_Channel1->CMAR = (uint32_t)src_ptr;	//the source is the RAM buffer
+	DMA1_Channel1->CNDTR = NVM_CFG_HALF_PAGE_WORDS;	//16 words
+	DMA1_Channel1->CCR |= (1<<14);				//memory-to-memory mode (MEM2MEM)
+	DMA1_Channel1->CCR |= (3<<12);				//very high priority (PL)
+	DMA1_Channel1->CCR |= (2<<10);				//32-bit memory side (MSIZE)
+	DMA1_Channel1->CCR |= (2<<8);				//32-bit peripheral side (PSIZE)
+	DMA1_Channel1->CCR |= (1<<7);				//memory increment (MINC)
+	DMA1_Channel1->CCR |= (1<<4);				//read from memory, write to peripheral (DIR)
+
+	//4)
+	if(prio_threshold == 0) {
+
+		window_start = NVM_IrqWindowOpen(&primask);
+												//we disable all the IRQs
+
+	} else {
+
+		for(uint8_t i = 0; i < NVM_NVIC_LINES; i++) {
+			if(((NVIC->ISER[0] & (1<<i)) == (1<<i)) && (((NVIC->IP[i >> 2] >> (((i & 3) << 3) + 6)) & 3) >= prio_threshold)) {
+				irq_mask |= (1<<i);				//we collect the active IRQs that are not more important than the threshold
+			}
+		}
+		NVIC->ICER[0] = irq_mask;				//we disable them
+
+		if(((SysTick->CTRL & (1<<1)) == (1<<1)) && (((SCB->SHP[1] >> 30) & 3) >= prio_threshold)) {
+			SysTick->CTRL &= ~(1<<1);			//SysTick isn't in the NVIC, we gate it with TICKINT
+			systick_gated = 1;
+		}										//Note: SysTick priority is bits 31:30 of SHPR3
+		__DSB();
+		__ISB();								//we make sure they can't fire after this point
+	}
+
+	//5)
+	NVM_WaitArm();
+	DMA1_Channel1->CCR |= (1<<0);				//DMA started
+	while(!((DMA1->ISR & (1<<1)) == (1<<1)));	//we wait for the transfer complete flag (TCIF1)
+	DMA1->IFCR = (1<<0);						//we clear all the flags of channel 1
+	DMA1_Channel1->CCR &= ~(1<<0);				//DMA stopped
+	NVM_TELEM_HALF_PAGE();
+
+	//6)
+	if(prio_threshold == 0) {
+
+		NVM_IrqWindowClose(primask, window_start);
+												//we re-enable the IRQs and log the masked window
+
+	} else {
+
+		NVIC->ISER[0] = irq_mask;				//we re-enable the IRQs we have disabled
+
+		if(systick_gated == 1) {
+			if((SysTick->CTRL & (1<<16)) == (1<<16)) SCB->ICSR = (1<<26);
+												//SysTick has reloaded meanwhile (COUNTFLAG), we pend its IRQ by hand (PENDSTSET)
+			SysTick->CTRL |= (1<<1);			//TICKINT back on
+		}
+
+	}
+
+	//7)
+	status = NVM_WaitDone();					//we wait until BSY is 0 and EOP is 1, then reset EOP
+
+	//8)
+	FLASH->PECR &= ~(1<<3);						//we disable the FLASH for programming
+	FLASH->PECR &= ~(1<<10);					//we disable the half-page programming mode
+	NVM_Lock();									//we set PELOCK on the NVM to 1, unless an NVM session is keeping it open
+
+	return status;
+}
+
+
+
+//19)Reset the IRQ window measurement
+void NVM_IrqWindowReset(void) {
+	/**
+	 * Clears the last/worst masked window values in NVM_irq_window.
+	 * The values are in core clock cycles, so the latency in us is cycles / (SystemCoreClock / 1000000).
+	 * The PRIMASK state is saved and restored, so this can be called with the IRQs already masked.
+	 **/
+
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	NVM_irq_window.last_cycles = 0;
+	NVM_irq_window.worst_cycles = 0;
+	NVM_irq_window.window_cnt = 0;
+	__set_PRIMASK(primask);						//we re-enable the IRQs, unless they were already disabled when we started
+}
+
+
+
+//20)Free running cycle counter
+uint32_t NVM_GetCycles(void) {
+	/**
+	 * The function MUST run in RAM, not in FLASH!!!!!! (so it can be used within the RAM functions)
+	 *
+	 * Returns the number of core clock cycles since the start, built from the HAL tick (uwTick) and the SysTick counter.
+	 * The M0+ has no DWT cycle counter, so this is the closest we get. The value wraps around after 2^32 cycles, so only the difference of two values should be used.
+	 *
+	 * 1)Read the tick and the counter until the tick doesn't change in between
+	 * 2)If SysTick has reloaded but its IRQ is still pending (IRQs masked), we add the missing tick
+	 **/
+
+	uint32_t tick_start;
+	uint32_t tick_end;
+	uint32_t systick_val;
+	uint32_t systick_reload = SysTick->LOAD + 1;
+
+	//1)
+	do {
+		tick_start = uwTick;
+		systick_val = SysTick->VAL;
+		tick_end = uwTick;
+	} while(tick_start != tick_end);
+
+	//2)
+	if(((SCB->ICSR & (1<<26)) == (1<<26)) && (systick_val > (systick_reload / 2))) {
+		tick_start++;							//PENDSTSET is 1 and the counter has just reloaded
+	}
+
+	return (tick_start * systick_reload) + (systick_reload - 1 - systick_val);
+												//SysTick counts down
+}
+
+
+
+#ifdef nvm_telemetry
+//21)Load the telemetry
+void NVM_TelemetryInit(void) {
+	/**
+	 * Loads the erase log saved in the NVM_TELEM page. The other counters start from 0 at every reset.
+	 * An erased NVM_TELEM page, or one without NVM_TELEM_MAGIC, is an empty log.
+	 **/
+
+	NVM_TelemetryLog_TypeDef* saved_log = (NVM_TelemetryLog_TypeDef*)&__nvm_telem_start__;
+
+	if(saved_log->magic == NVM_TELEM_MAGIC) {
+		NVM_telemetry.log = *saved_log;
+	} else {
+		NVM_telemetry.log = (NVM_TelemetryLog_TypeDef){0};
+		NVM_telemetry.log.magic = NVM_TELEM_MAGIC;
+	}
+
+	NVM_telemetry.unsaved_cnt = 0;
+	NVM_telemetry.save_pending = 0;
+}
+
+
+//22)Save the telemetry
+void NVM_TelemetrySave(void) {
+	/**
+	 * Writes the erase log into the NVM_TELEM page.
+	 * NVM_TelemetryPoll calls this every NVM_TELEM_SAVE_EVERY erases, so at most that many erases are lost on a reset. It can also be called directly (e.g. before a planned reset).
+	 * The save is an erase itself and it is counted in the log it writes: the NVM_TELEM page wears at 1/NVM_TELEM_SAVE_EVERY of the erase rate.
+	 *
+	 * Note: must not be called while the asynchronous mode is running.
+	 **/
+
+	uint32_t telem_page_addr = (uint32_t)&__nvm_telem_start__;
+
+	if(FLASHErase_Page(telem_page_addr) != NVM_OK) return;
+	if(FLASHUpd_HalfPageStream((uint32_t*)&NVM_telemetry.log, telem_page_addr, NVM_CFG_PAGE_WORDS) != NVM_OK) return;
+												//the pending flag stays set if we failed, the next poll tries again
+
+	NVM_telemetry.unsaved_cnt = 0;
+	NVM_telemetry.save_pending = 0;
+}
+
+
+//23)Query the telemetry
+uint16_t NVM_TelemetryPageErases(uint32_t flash_addr) {
+	/**
+	 * Returns the erase count of the page that holds "flash_addr" if it is in the NVM data area, or of its bucket otherwise. The counts of the other fields can be read directly from NVM_telemetry.
+	 **/
+
+	if((flash_addr >= NVM_TELEM_DATA_BASE) && (flash_addr < (NVM_TELEM_DATA_BASE + NVM_CFG_DATA_SIZE))) {
+		return NVM_telemetry.log.page_hist[(flash_addr - NVM_TELEM_DATA_BASE) / NVM_CFG_PAGE_BYTES];
+	}
+
+	uint32_t bucket = (flash_addr - NVM_TELEM_FLASH_BASE) >> NVM_TELEM_BUCKET_SHIFT;
+
+	if(bucket >= NVM_TELEM_BUCKET_CNT) return 0;
+
+	return NVM_telemetry.log.bucket_hist[bucket];
+}
+
+
+//24)Print the telemetry
+void NVM_TelemetryDump(void) {
+	/**
+	 * Prints the counters, the erased NVM data pages and the non-empty buckets (printf goes to USART2).
+	 **/
+
+	printf("NVM telemetry\r\n");
+	printf("  erases: %lu, words: %lu, half pages: %lu\r\n", (unsigned long)NVM_telemetry.erase_cnt, (unsigned long)NVM_telemetry.word_cnt, (unsigned long)NVM_telemetry.half_page_cnt);
+	printf("  busy cycles: %lu, worst: %lu\r\n", (unsigned long)NVM_telemetry.busy_cycles, (unsigned long)NVM_telemetry.worst_busy_cycles);
+	printf("  lifetime erases: %lu, unsaved: %u\r\n", (unsigned long)NVM_telemetry.log.erase_total, NVM_telemetry.unsaved_cnt);
+	printf("  NVM data pages:\r\n");
+
+	for(uint8_t i = 0; i < NVM_TELEM_PAGE_CNT; i++) {
+		if(NVM_telemetry.log.page_hist[i] != 0) {
+			printf("    0x%08lX: %u\r\n", (unsigned long)(NVM_TELEM_DATA_BASE + ((uint32_t)i * NVM_CFG_PAGE_BYTES)), NVM_telemetry.log.page_hist[i]);
+		}
+	}
+
+	printf("  other FLASH (%lu kbyte buckets):\r\n", (unsigned long)((1UL << NVM_TELEM_BUCKET_SHIFT) / 1024));
+
+	for(uint8_t i = 0; i < NVM_TELEM_BUCKET_CNT; i++) {
+		if(NVM_telemetry.log.bucket_hist[i] != 0) {
+			printf("    0x%08lX: %u\r\n", (unsigned long)(NVM_TELEM_FLASH_BASE + ((uint32_t)i << NVM_TELEM_BUCKET_SHIFT)), NVM_telemetry.log.bucket_hist[i]);
+		}
+	}
+}
+#endif
+
+
+
+//25)Abort the asynchronous queue
+static void NVM_AsyncAbort(uint8_t status) {
+	/**
+	 * Called from the FLASH IRQ when an operation of the queue has failed. The remaining operations are dropped and the callback gets the error code.
+	 *
+	 * Note: there is no timeout in the asynchronous mode. If EOP never comes, NVM_AsyncBusy stays 1.
+	 **/
+
+	FLASH->PECR &= ~((1<<3) | (1<<9) | (1<<10));	//we leave any programming/erasing mode
+	if(NVM_lowpower.sleep_on_busy == 0) FLASH->PECR &= ~(1<<16);
+												//EOP interrupt disabled (EOPIE), unless the low power mode needs it
+	NVM_SessionEnd();
+
+	NVM_async.head = 0;
+	NVM_async.tail = 0;
+	NVM_async.count = 0;
+	NVM_async.busy = 0;
+
+	if(NVM_async.callback != 0) NVM_async.callback(status);
+}
+
+
+//26)Set the retry policy
+void NVM_SetRetryPolicy(uint8_t max_retries, uint16_t backoff_ms) {
+	/**
+	 * "max_retries" is the number of times a transient failure (timeout, fetch while write) is retried by the blocking primitives. 0 switches the retries off, which is the default.
+	 * "backoff_ms" is the wait before the first retry, doubled every time after.
+	 **/
+
+	NVM_retry.max_retries = max_retries;
+	NVM_retry.backoff_ms = backoff_ms;
+}
+
+
+//27)CRC of a FLASH region
+uint32_t FLASHRegion_CRC(uint32_t flash_addr, uint32_t word_cnt) {
+	/**
+	 * Returns the CRC (see CRCDriver) of "word_cnt" words starting at "flash_addr".
+	 * The region is fed to the CRC peripheral in NVM_CRC_CHUNK_WORDS pieces, so the IRQs are not masked for the whole region.
+	 *
+	 * Note: an 8 kbyte app slot is 2048 word reads, which is about as fast as the FLASH can be read.
+	 **/
+
+	uint32_t crc_value = CRC_INITIAL_VALUE;
+	uint32_t chunk_word_cnt;
+
+	while(word_cnt != 0) {
+		chunk_word_cnt = (word_cnt > NVM_CRC_CHUNK_WORDS) ? NVM_CRC_CHUNK_WORDS : word_cnt;
+		crc_value = CRC_Accumulate(crc_value, (const uint32_t*)flash_addr, chunk_word_cnt);
+		flash_addr = flash_addr + (chunk_word_cnt * 4);
+		word_cnt = word_cnt - chunk_word_cnt;
+	}
+
+	return crc_value;
+}
+
+
+//28)Verify written data
+uint8_t FLASHVerify(uint32_t flash_addr, const uint32_t* src_ptr, uint32_t word_cnt) {
+	/**
+	 * Compares the CRC of the FLASH region with the CRC of the source.
+	 *
+	 * Returns NVM_OK if they match, NVM_ERR_VERIFY otherwise.
+	 *
+	 * Note: a CRC match is not a proof of a bit-exact match, but a missing or corrupted write is found with a probability of 1 - 2^-32.
+	 * Note: for a bit-exact check without the CRC peripheral, use NVM_WordCompare.
+	 **/
+
+	uint32_t src_crc = CRC_INITIAL_VALUE;
+	uint32_t chunk_word_cnt;
+	uint32_t remaining_word_cnt = word_cnt;
+	const uint32_t* chunk_ptr = src_ptr;
+
+	while(remaining_word_cnt != 0) {
+		chunk_word_cnt = (remaining_word_cnt > NVM_CRC_CHUNK_WORDS) ? NVM_CRC_CHUNK_WORDS : remaining_word_cnt;
+		src_crc = CRC_Accumulate(src_crc, chunk_ptr, chunk_word_cnt);
+		chunk_ptr = chunk_ptr + chunk_word_cnt;
+		remaining_word_cnt = remaining_word_cnt - chunk_word_cnt;
+	}
+
+	if(FLASHRegion_CRC(flash_addr, word_cnt) != src_crc) {
+		NVM_LogError(NVM_ERR_VERIFY, 0);
+		return NVM_ERR_VERIFY;
+	}
+
+	return NVM_OK;
+}
+
+
+//29)Write a word as it is
+uint8_t FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
+	return FLASHUpd_WordOrder(flash_word_addr, updated_flash_value, NVM_BYTE_ORDER_NATIVE);
+}
+
+
+//30)Write consecutive half-pages as they are
+uint8_t FLASHUpd_HalfPageStream(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt) {
+	return FLASHUpd_HalfPageStreamOrder(src_ptr, flash_half_page_addr, word_cnt, NVM_BYTE_ORDER_NATIVE);
+}
+
+
+//31)Write a byte into the data EEPROM
+uint8_t EEPROMUpd_Byte(uint32_t eeprom_addr, uint8_t value) {
+	return NVM_EEPROMWrite(eeprom_addr, value, 1);
+}
+
+
+//32)Write a half-word into the data EEPROM
+uint8_t EEPROMUpd_HalfWord(uint32_t eeprom_addr, uint16_t value) {
+	return NVM_EEPROMWrite(eeprom_addr, value, 2);
+}
+
+
+//33)Write a word into the data EEPROM
+uint8_t EEPROMUpd_Word(uint32_t eeprom_addr, uint32_t value) {
+	/**
+	 * Unlike the FLASH, the data EEPROM can be written at any time: there is no erase beforehand and no half page latch.
+	 * A word write takes about 3.2 ms if the target has to be erased by the hardware, half of that otherwise.
+	 *
+	 * Returns NVM_OK or an NVM_ERR_ code. NVM_ERR_RANGE if the address is not in the data EEPROM.
+	 **/
+
+	return NVM_EEPROMWrite(eeprom_addr, value, 4);
+}
+
+
+//34)Write data into either backend
+uint8_t NVM_Write(uint32_t nvm_addr, const uint8_t* src_ptr, uint32_t byte_cnt) {
+	/**
+	 * Common entry of the two backends. The backend is picked by the target address:
+	 * - data EEPROM: written word by word where the address allows it, with bytes/half-words at the unaligned ends. Nothing is erased.
+	 * - FLASH: written by FLASHUpd_Delta, so the rest of the touched pages is kept and only the pages that differ are erased. The address and the length must be word aligned.
+	 * The source can be anywhere, it is only read by the CPU.
+	 *
+	 * 1)Pick the backend
+	 * 2)EEPROM: step through the data with the widest write the alignment allows
+	 * 3)FLASH: delta update
+	 *
+	 * Returns NVM_OK or an NVM_ERR_ code. NVM_ERR_RANGE if the area is in neither backend.
+	 **/
+
+	uint8_t status = NVM_OK;
+
+	//1)
+	uint8_t backend = NVM_BackendOf(nvm_addr);
+	if((backend != NVM_BackendOf(nvm_addr + byte_cnt - 1)) || (byte_cnt == 0)) return NVM_ERR_RANGE;
+												//the area must not cross from one backend into the other
+
+	//2)
+	if(backend == NVM_BACKEND_EEPROM) {
+		NVM_SessionBegin();						//one unlock for the whole record
+		while((byte_cnt != 0) && (status == NVM_OK)) {
+			if(((nvm_addr & 0x3) == 0) && (byte_cnt >= 4)) {
+				status = EEPROMUpd_Word(nvm_addr, (uint32_t)src_ptr[0] | ((uint32_t)src_ptr[1] << 8) | ((uint32_t)src_ptr[2] << 16) | ((uint32_t)src_ptr[3] << 24));
+				nvm_addr += 4; src_ptr += 4; byte_cnt -= 4;
+			} else if(((nvm_addr & 0x1) == 0) && (byte_cnt >= 2)) {
+				status = EEPROMUpd_HalfWord(nvm_addr, (uint16_t)(src_ptr[0] | (src_ptr[1] << 8)));
+				nvm_addr += 2; src_ptr += 2; byte_cnt -= 2;
+			} else {
+				status = EEPROMUpd_Byte(nvm_addr, src_ptr[0]);
+				nvm_addr += 1; src_ptr += 1; byte_cnt -= 1;
+			}									//Note: the source is assembled byte by byte, so it doesn't need to be aligned
+		}
+		NVM_SessionEnd();
+		return status;
+	}
+
+	//3)
+	if(backend == NVM_BACKEND_FLASH) {
+		if(((nvm_addr & 0x3) != 0) || ((byte_cnt & 0x3) != 0) || (((uint32_t)src_ptr & 0x3) != 0)) return NVM_ERR_PGA;
+		return FLASHUpd_Delta((uint32_t*)src_ptr, nvm_addr, byte_cnt / 4);
+	}
+
+	return NVM_ERR_RANGE;
+}
+
+
+//35)Backend of an address
+uint8_t NVM_BackendOf(uint32_t nvm_addr) {
+	if((nvm_addr >= NVM_EEPROM_BASE) && (nvm_addr < (NVM_EEPROM_BASE + NVM_EEPROM_SIZE))) return NVM_BACKEND_EEPROM;
+	if((nvm_addr >= NVM_TELEM_FLASH_BASE) && (nvm_addr < (NVM_TELEM_FLASH_BASE + NVM_FLASH_SIZE))) return NVM_BACKEND_FLASH;
+	return NVM_BACKEND_NONE;
+}
+
+
+//36)Routing policy
+uint8_t NVM_Route(uint32_t record_bytes, uint32_t updates_per_day) {
+	/**
+	 * Picks the backend a record should be kept in.
+	 * - Anything bigger than NVM_ROUTE_EEPROM_MAX_BYTES goes into the FLASH: code images and tables are written in half page bursts, and the EEPROM (NVM_CFG_EEPROM_SIZE, 2 to 6 kbytes depending on the part) is too small to hold many of them anyway.
+	 * - A small record that changes at least NVM_ROUTE_EEPROM_MIN_DAILY times a day goes into the EEPROM. There each update is a ~3 ms word write, while in the FLASH it would cost a page erase every time (10k cycles endurance against 100k).
+	 * - A small record that hardly ever changes stays in the FLASH, so the EEPROM is left for the records that need it.
+	 *
+	 * Returns NVM_BACKEND_EEPROM or NVM_BACKEND_FLASH. NVM_RecordPlace turns this into an address.
+	 **/
+
+	if(record_bytes > NVM_ROUTE_EEPROM_MAX_BYTES) return NVM_BACKEND_FLASH;
+	if(updates_per_day >= NVM_ROUTE_EEPROM_MIN_DAILY) return NVM_BACKEND_EEPROM;
+	return NVM_BACKEND_FLASH;
+}
+
+
+//37)Low power mode
+void NVM_SetLowPower(uint8_t sleep_on_busy, uint16_t idle_window_ms) {
+	/**
+	 * "sleep_on_busy" at 1 makes the blocking primitives sleep (WFI) while the FLASH is busy, instead of polling at full power.
+	 * "idle_window_ms" is how long the application must have been idle (see NVM_IdleKick) before a deferred queue is launched by NVM_IdlePoll.
+	 *
+	 * 1)Sleep, not Stop: SLEEPDEEP is cleared
+	 * 2)EOPIE is kept enabled as long as the mode is on, so the end of every operation raises the FLASH IRQ
+	 *
+	 * Note: must be called after NVM_Init, and the FLASH IRQ must be enabled (see FLASHIRQPriorEnable). Without it, the core only wakes up with the SysTick, once every ms.
+	 * Note: SLEEP_PD in ACR must stay 0, the FLASH must not be powered down in Sleep while it is being programmed.
+	 **/
+
+	//1)
+	SCB->SCR &= ~(1<<2);						//SLEEPDEEP is 0, WFI enters Sleep mode
+
+	//2)
+	NVM_UnlockPECR();
+	if(sleep_on_busy == 1) {
+		FLASH->PECR |= (1<<16);					//EOP interrupt enabled (EOPIE)
+	} else if(NVM_async.busy == 0) {
+		FLASH->PECR &= ~(1<<16);				//EOP interrupt disabled (EOPIE)
+	}
+	NVM_Lock();
+
+	NVM_lowpower.sleep_on_busy = sleep_on_busy;
+	NVM_lowpower.idle_window_ms = idle_window_ms;
+	NVM_lowpower.idle_tick = HAL_GetTick();
+}
+
+
+//38)Note application activity
+void NVM_IdleKick(void) {
+	/**
+	 * To be called by the application whenever it is busy with something (a button press, a transfer...). It restarts the idle window.
+	 **/
+
+	NVM_lowpower.idle_tick = HAL_GetTick();
+}
+
+
+//39)Start the asynchronous queue in the next idle window
+uint8_t NVM_AsyncStartDeferred(void (*callback)(uint8_t status)) {
+	/**
+	 * Same as NVM_AsyncStart, but the queue is not launched here. NVM_IdlePoll launches it once the application has been idle for NVM_lowpower.idle_window_ms.
+	 * Writes that are not urgent can be queued over time, and then run in one batch within one NVM session.
+	 *
+	 * Returns 1 if the start has been deferred, 0 if the queue is empty or already running.
+	 **/
+
+	if((NVM_async.busy == 1) || (NVM_async.count == 0)) return 0;
+
+	NVM_lowpower.deferred_callback = callback;
+	NVM_lowpower.deferred = 1;
+
+	return 1;
+}
+
+
+//40)Launch the deferred queue when idle
+void NVM_IdlePoll(void) {
+	/**
+	 * To be called from the main loop.
+	 * The deferred start stays pending until NVM_AsyncStart accepts it. If the queue is still busy (e.g. started directly in the meantime), we try again at the next poll, so the callback is not lost.
+	 * If the queue has been emptied meanwhile (a direct start has run it, or an error has aborted it), there is nothing left to start and the request is dropped.
+	 **/
+
+	if(NVM_lowpower.deferred == 0) return;
+	if((HAL_GetTick() - NVM_lowpower.idle_tick) < NVM_lowpower.idle_window_ms) return;
+
+	if(NVM_async.count == 0) {
+		NVM_lowpower.deferred = 0;
+		return;
+	}
+
+	if(NVM_AsyncStart(NVM_lowpower.deferred_callback) == 1) NVM_lowpower.deferred = 0;
+}
+
+
+//41)Check the config against the linker script
+uint8_t NVM_ConfigCheck(void) {
+	/**
+	 * The linker symbols only get their values at link time, so they can't be checked by the compiler. The linker script checks them against the exported __nvm_cfg_ symbols, and we compare them with NVMConfig at run time here as well.
+	 * A mismatch means the linker script was made for another part (or another slot layout) than the one picked with the "nvm_part_" define. NVM_Init stops the code then.
+	 *
+	 * Returns the number of values that don't match, 0 if the config is good.
+	 **/
+
+	uint8_t mismatch_cnt = 0;
+
+	if((uint32_t)&__app_slot_a_start__ != NVM_CFG_APP_SLOT_A) mismatch_cnt++;
+	if((uint32_t)&__app_slot_b_start__ != NVM_CFG_APP_SLOT_B) mismatch_cnt++;
+	if((uint32_t)&__app_slot_size__ != NVM_CFG_APP_SLOT_SIZE) mismatch_cnt++;
+	if((uint32_t)&__app_section_start__ != NVM_CFG_APP_SLOT_A) mismatch_cnt++;
+												//Blink_custom is the first thing in slot A
+
+	return mismatch_cnt;
+}
+
+
+//42)Bank of an address
+uint8_t NVM_BankOf(uint32_t flash_addr) {
+	return NVM_BANK_OF(flash_addr);
+}
+
+
+//43)Check if a FLASH area can be written while we run from FLASH
+uint8_t NVM_RwwPossible(uint32_t flash_addr, uint32_t byte_cnt) {
+	/**
+	 * Returns 1 if the area is entirely in a bank that holds neither the code, the app nor the vector table, 0 otherwise or on a single bank part.
+	 **/
+
+	return NVM_RwwTarget(flash_addr, byte_cnt);
+}
+
+
+//44)Write consecutive half-pages into the other bank
+uint8_t FLASHUpd_HalfPageRWWOrder(const uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order) {
+	/**
+	 * The read-while-write version of FLASHUpd_HalfPageStreamOrder, for dual bank parts.
+	 * The target is in the other bank, so this function runs from FLASH, the IRQs stay enabled during the latch loads, and the source may be in RAM or in our own bank of FLASH.
+	 * With "byte_order" NVM_BYTE_ORDER_SWAP, every word is swapped with REV on its way into the latch, like in the RAM writer. The source is not changed.
+	 *
+	 * 1)Check that the target allows it, the RAM writer is used otherwise (with the source copied, if it is not in RAM)
+	 * 2)Unlock and pick half page programming
+	 * 3)Write the full half pages one after the other
+	 * 4)Write the remaining words, if any
+	 * 5)Close NVM
+	 *
+	 * Returns NVM_OK or the NVM_ERR_ code of the first burst/word that failed (after the retries). With the "nvm_verify" define, NVM_ERR_VERIFY if the FLASH doesn't hold the data afterwards.
+	 *
+	 * Note: the core is only stalled if it reads the bank being written. The polling of NVM_WaitDone runs from RAM anyway.
+	 **/
+
+	uint32_t half_page_cnt = word_cnt / NVM_CFG_HALF_PAGE_WORDS;
+	uint32_t remaining_word_cnt = word_cnt % NVM_CFG_HALF_PAGE_WORDS;
+	uint8_t status = NVM_OK;
+	uint8_t attempt;
+#ifdef nvm_verify
+	const uint32_t* verify_src_ptr = src_ptr;
+	uint32_t verify_flash_addr = flash_half_page_addr;
+#endif
+
+	//1)
+	if(NVM_RwwTarget(flash_half_page_addr, word_cnt * 4) == 0) {
+		if(((uint32_t)src_ptr >= NVM_CFG_FLASH_BASE) && ((uint32_t)src_ptr < (NVM_CFG_FLASH_BASE + NVM_CFG_FLASH_SIZE))) return NVM_ERR_RANGE;
+												//the RAM writer would abort its bursts reading a FLASH source
+		return FLASHUpd_HalfPageStreamOrder((uint32_t*)src_ptr, flash_half_page_addr, word_cnt, byte_order);
+	}
+
+	//2)
+	NVM_UnlockPECR();
+	NVM_UnlockPRG();
+	FLASH->PECR &= ~(1<<9);						//we make sure we are not in ERASE mode
+	FLASH->PECR |= (1<<3);						//we pick the FLASH for programming (PRG)
+	FLASH->PECR |= (1<<10);						//we pick the half-page programming mode (FPPRG)
+
+	//3)
+	for(uint32_t j = 0; (j < half_page_cnt) && (status == NVM_OK); j++) {
+		attempt = 0;
+
+		do {
+			NVM_WaitArm();
+			for(uint8_t i = 0; i < NVM_CFG_HALF_PAGE_WORDS; i++) {
+				*(__IO uint32_t*)(flash_half_page_addr) = (byte_order == NVM_BYTE_ORDER_SWAP) ? __REV(src_ptr[i]) : src_ptr[i];
+			}									//no IRQ masking: nothing we fetch is in the bank being written, so the order can be checked per word
+			NVM_TELEM_HALF_PAGE();
+
+			status = NVM_WaitDone();
+		} while((status != NVM_OK) && NVM_IsBlank(flash_half_page_addr, NVM_CFG_HALF_PAGE_WORDS) && NVM_RetryAllowed(status, &attempt));
+
+		src_ptr = src_ptr + NVM_CFG_HALF_PAGE_WORDS;
+		flash_half_page_addr = flash_half_page_addr + NVM_CFG_HALF_PAGE_BYTES;
+	}
+
+	//4)
+	FLASH->PECR &= ~(1<<3);						//we disable the FLASH for programming
+	FLASH->PECR &= ~(1<<10);					//we disable the half-page programming mode
+
+	for(uint32_t i = 0; (i < remaining_word_cnt) && (status == NVM_OK); i++) {
+		status = FLASHUpd_WordOrder(flash_half_page_addr, *src_ptr, byte_order);
+		src_ptr++;
+		flash_half_page_addr = flash_half_page_addr + 4;
+	}
+
+#ifdef nvm_verify
+	if((status == NVM_OK) && (byte_order == NVM_BYTE_ORDER_NATIVE)) {
+		status = FLASHVerify(verify_flash_addr, verify_src_ptr, word_cnt);
+												//the whole stream is checked in one pass at the end, like in the RAM writer
+	} else if((status == NVM_OK) && (byte_order == NVM_BYTE_ORDER_SWAP)) {
+		for(uint32_t i = 0; (i < word_cnt) && (status == NVM_OK); i++) {
+			if(*(__IO uint32_t*)(verify_flash_addr + (i * 4)) != __REV(verify_src_ptr[i])) status = NVM_ERR_VERIFY;
+		}								//the CRC peripheral can't swap bytes, so a swapped stream is compared word by word
+	}
+#endif
+
+	//5)
+	NVM_Lock();
+
+	return status;
+}
+
+
+//45)Write consecutive half-pages with the best writer for the target
+uint8_t FLASHUpd_HalfPageStreamBankOrder(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order) {
+	/**
+	 * Picks the read-while-write writer if the target is in the other bank, the RAM writer otherwise. The source must be in RAM.
+	 * Both writers swap on the fly with NVM_BYTE_ORDER_SWAP, so a swapped source needs no pass of its own.
+	 **/
+
+	if(NVM_RwwTarget(flash_half_page_addr, word_cnt * 4) == 1) return FLASHUpd_HalfPageRWWOrder(src_ptr, flash_half_page_addr, word_cnt, byte_order);
+	return FLASHUpd_HalfPageStreamOrder(src_ptr, flash_half_page_addr, word_cnt, byte_order);
+}
+
+//46)Open a read view
+uint8_t NVM_ViewOpen(NVM_View_TypeDef* view, uint32_t nvm_addr, uint32_t word_cnt) {
+	/**
+	 * A read view is a pointer, checked once, to "word_cnt" words of FLASH or data EEPROM. The words are read through the view where they are, nothing is copied into RAM.
+	 * Use NVM_VIEW_WORD to read from the view, or pass view->base to NVM_WordCompare/NVM_WordScan.
+	 *
+	 * 1)Check the alignment
+	 * 2)Check that the whole region is in one backend
+	 * 3)Fill the view
+	 *
+	 * Returns NVM_OK, NVM_ERR_PGA if the address is not word aligned or NVM_ERR_RANGE if the region is not in a backend.
+	 * Note: the view is not a lock. If the region is erased or written, the view shows the new content.
+	 **/
+
+	//1)
+	if((nvm_addr & 0x3) != 0) return NVM_ERR_PGA;
+
+	//2)
+	uint8_t backend = NVM_BackendOf(nvm_addr);
+
+	if((backend == NVM_BACKEND_NONE) || (word_cnt == 0)) return NVM_ERR_RANGE;
+	if(NVM_BackendOf(nvm_addr + (word_cnt * 4) - 1) != backend) return NVM_ERR_RANGE;
+
+	//3)
+	view->base = (const uint32_t*)nvm_addr;
+	view->word_cnt = word_cnt;
+
+	return NVM_OK;
+}
+
+//47)Compare two word areas
+uint32_t NVM_WordCompare(const uint32_t* a_ptr, const uint32_t* b_ptr, uint32_t word_cnt) {
+	/**
+	 * Compares "word_cnt" words of two areas (FLASH, EEPROM or RAM, in any combination).
+	 * Both sides are read four words at a time with NVM_LDM4, the words left at the end one by one.
+	 *
+	 * Returns the index of the first word that differs, word_cnt if the areas match.
+	 * Note: the index returned for a difference within a block of four is the first differing word of that block.
+	 **/
+
+	uint32_t i = 0;
+	uint32_t a0, a1, a2, a3;
+	uint32_t b0, b1, b2, b3;
+
+	while((word_cnt - i) >= 4) {
+		NVM_LDM4(a_ptr, a0, a1, a2, a3);
+		NVM_LDM4(b_ptr, b0, b1, b2, b3);
+		if(((a0 ^ b0) | (a1 ^ b1) | (a2 ^ b2) | (a3 ^ b3)) != 0) {
+			if(a0 != b0) return i;
+			if(a1 != b1) return i + 1;
+			if(a2 != b2) return i + 2;
+			return i + 3;
+		}
+		i = i + 4;
+	}
+
+	while(i < word_cnt) {
+		if(*a_ptr++ != *b_ptr++) return i;
+		i++;
+	}
+
+	return word_cnt;
+}
+
+//48)Scan a word area for a word that is not "value"
+uint32_t NVM_WordScan(const uint32_t* ptr, uint32_t word_cnt, uint32_t value) {
+	/**
+	 * Reads "word_cnt" words four at a time with NVM_LDM4 and returns the index of the first word that is not "value", word_cnt if all of them are.
+	 * With value 0, this is the blank check of the FLASH (an erased word reads as 0 on L0xx).
+	 **/
+
+	uint32_t i = 0;
+	uint32_t w0, w1, w2, w3;
+
+	while((word_cnt - i) >= 4) {
+		NVM_LDM4(ptr, w0, w1, w2, w3);
+		if(((w0 ^ value) | (w1 ^ value) | (w2 ^ value) | (w3 ^ value)) != 0) {
+			if(w0 != value) return i;
+			if(w1 != value) return i + 1;
+			if(w2 != value) return i + 2;
+			return i + 3;
+		}
+		i = i + 4;
+	}
+
+	while(i < word_cnt) {
+		if(*ptr++ != value) return i;
+		i++;
+	}
+
+	return word_cnt;
+}
+
+//49)Blank check of a FLASH region
+uint8_t FLASHRegion_IsBlank(uint32_t flash_addr, uint32_t word_cnt) {
+	/**
+	 * Returns 1 if all "word_cnt" words from "flash_addr" are erased (0), 0 otherwise.
+	 * Unlike FLASHPage_IsBlank, the region doesn't need to be a page. The address must be word aligned.
+	 **/
+
+	return (NVM_WordScan((const uint32_t*)flash_addr, word_cnt, 0) == word_cnt) ? 1 : 0;
+}
+
+
+#ifdef nvm_telemetry
+//50)Save the telemetry when it is due
+void NVM_TelemetryPoll(void) {
+	/**
+	 * To be called from the main loop.
+	 * The erases only flag the save (see NVM_TelemLogErase), the save itself is done here, outside the NVM sessions and the asynchronous mode:
+	 * 1) every NVM_TELEM_SAVE_EVERY erases
+	 * 2) when the count of a page or bucket crosses a multiple of NVM_TELEM_WEAR_STEP
+	 **/
+
+	if(NVM_telemetry.save_pending == 0) return;
+	if((NVM_async.busy == 1) || (NVM_session.depth != 0)) return;
+												//we try again at the next poll
+
+	NVM_TelemetrySave();
+}
+#endif
+
+
+//51)Place a record
+uint32_t NVM_RecordPlace(uint32_t record_bytes, uint32_t updates_per_day, uint32_t flash_addr) {
+	/**
+	 * Gives a record its address, in the backend picked by NVM_Route.
+	 * "flash_addr" is the FLASH home of the record, reserved by the caller (e.g. a linker section). A record routed to the EEPROM gets the next free word aligned EEPROM area instead.
+	 * The returned address is then written with NVM_Write, which follows the backend of the address.
+	 *
+	 * 1)Route the record
+	 * 2)Take the next EEPROM area, or stay in the FLASH if the EEPROM is full
+	 *
+	 * Note: the allocation is not stored anywhere. The records must be placed in the same order at every boot (e.g. all of them at init), then they get the same addresses again.
+	 **/
+
+	uint32_t eeprom_addr = NVM_eeprom_next;
+	uint32_t eeprom_bytes = (record_bytes + 3) & ~(uint32_t)0x3;
+												//NVM_Write can then use word writes for the whole record
+
+	//1)
+	if(NVM_Route(record_bytes, updates_per_day) == NVM_BACKEND_FLASH) return flash_addr;
+
+	//2)
+	if((record_bytes == 0) || (eeprom_bytes > ((NVM_EEPROM_BASE + NVM_EEPROM_SIZE) - eeprom_addr))) return flash_addr;
+
+	NVM_eeprom_next = eeprom_addr + eeprom_bytes;
+
+	return eeprom_addr;
+}
+
+
+//52)Write consecutive half-pages into the other bank as they are
+uint8_t FLASHUpd_HalfPageRWW(const uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt) {
+	return FLASHUpd_HalfPageRWWOrder(src_ptr, flash_half_page_addr, word_cnt, NVM_BYTE_ORDER_NATIVE);
+}
+
+
+//53)Write consecutive half-pages as they are, with the best writer for the target
+uint8_t FLASHUpd_HalfPageStreamBank(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt) {
+	return FLASHUpd_HalfPageStreamBankOrder(src_ptr, flash_half_page_addr, word_cnt, NVM_BYTE_ORDER_NATIVE);
+}
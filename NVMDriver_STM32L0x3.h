@@ -3,7 +3,7 @@
  *  Author: BalazsFarkas
  *  Project: STM32_NVMDriver
  *  Processor: STM32L053R8
- *  Header version: 1.0
+ *  Header version: 2.8
  *  File: NVMDriver_STM32L0x3.h
  */
 
@@ -13,23 +13,218 @@
 #include "stdint.h"
 #include "stm32l053xx.h"
 
+#include "NVMConfig_STM32L0x3.h"
 #include "EXTIDriver_STM32L0x3.h"
+#include "CRCDriver_STM32L0x3.h"
 
 //LOCAL CONSTANT
+#define NVM_ASYNC_QUEUE_LEN			8			//number of operations the asynchronous mode can hold
+
+#define NVM_OP_ERASE_PAGE			0
+#define NVM_OP_WORD					1
+#define NVM_OP_HALF_PAGE			2
+
+#define NVM_OK						0			//status codes of the primitives
+#define NVM_ERR_WRP					1			//write protection (WRPERR)
+#define NVM_ERR_PGA					2			//alignment (PGAERR)
+#define NVM_ERR_SIZE				3			//size (SIZERR)
+#define NVM_ERR_OPTV				4			//option validity (OPTVERR)
+#define NVM_ERR_RD					5			//read protection (RDERR)
+#define NVM_ERR_NOTZERO				6			//target not erased (NOTZEROERR)
+#define NVM_ERR_FWW					7			//fetch while write (FWWERR)
+#define NVM_ERR_TIMEOUT				8			//BSY/EOP did not finish within NVM_TIMEOUT_MS
+#define NVM_ERR_VERIFY				9			//the FLASH doesn't hold what we have written
+#define NVM_ERR_RANGE				10			//the address is not in the backend
+#define NVM_ERR_CONFIG				11			//NVMConfig doesn't match the linker script
+#define NVM_ERR_BUSY				12			//an earlier operation is still open and must be finished first
+
+#define NVM_BYTE_ORDER_NATIVE		0			//words are written as they are
+#define NVM_BYTE_ORDER_SWAP			1			//words are byte swapped (REV) on their way into the FLASH
+												//Note: only the ...Order writers (FLASHUpd_WordOrder, FLASHUpd_HalfPageStreamOrder, FLASHUpd_HalfPageRWWOrder, FLASHUpd_HalfPageStreamBankOrder) swap, every other writer is NATIVE
+
+#define NVM_IDLE_WINDOW_MS			500			//default idle window before a deferred queue is launched
+
+#define NVM_TIMEOUT_MS				10			//an erase or a half page takes about 3.2 ms
+#define NVM_CRC_CHUNK_WORDS			CRC_CHUNK_WORDS	//words hashed with the IRQs masked at a time
+
+#define NVM_BACKEND_NONE			0
+#define NVM_BACKEND_FLASH			1
+#define NVM_BACKEND_EEPROM			2
+
+#define NVM_NVIC_LINES				32			//IRQ lines in NVIC->ISER[0] on the Cortex-M0+
+
+#define NVM_BANK_NONE				0			//not in the FLASH
+#define NVM_BANK_1					1
+#define NVM_BANK_2					2
+#define NVM_BANK_OF(addr)			((((addr) < NVM_CFG_FLASH_BASE) || ((addr) >= (NVM_CFG_FLASH_BASE + NVM_CFG_FLASH_SIZE))) ? NVM_BANK_NONE : (((addr) < NVM_CFG_BANK2_BASE) ? NVM_BANK_1 : NVM_BANK_2))
+												//a macro, so the RAM functions don't have to call into the FLASH for it
+
+#define NVM_EEPROM_BASE				NVM_CFG_EEPROM_BASE
+#define NVM_EEPROM_SIZE				NVM_CFG_EEPROM_SIZE
+#define NVM_FLASH_SIZE				NVM_CFG_FLASH_SIZE
+
+#define NVM_ROUTE_EEPROM_MAX_BYTES	64			//records above this size go into the FLASH
+#define NVM_ROUTE_EEPROM_MIN_DAILY	1			//small records updated at least this many times a day go into the EEPROM
+
+#define NVM_TELEM_FLASH_BASE		NVM_CFG_FLASH_BASE	//start of the FLASH
+#define NVM_TELEM_BUCKET_SHIFT		NVM_CFG_TELEM_BUCKET_SHIFT	//4 kbyte buckets for the code and the app slots of the L053
+#define NVM_TELEM_BUCKET_CNT		24
+#define NVM_TELEM_DATA_BASE			NVM_CFG_DATA_BASE	//the NVM data pages get a counter each
+#define NVM_TELEM_PAGE_CNT			(NVM_CFG_DATA_SIZE / NVM_CFG_PAGE_BYTES)
+#define NVM_TELEM_MAGIC				0x54454C31	//"TEL1", anything else in the NVM_TELEM page is an empty log
+#define NVM_TELEM_SAVE_EVERY		64			//the log is saved after this many erases...
+#define NVM_TELEM_WEAR_STEP			1024		//...or when a counter crosses a multiple of this, must be a power of 2
 
 //LOCAL VARIABLE
+typedef struct {
+	uint8_t depth;								//number of NVM_SessionBegin calls not yet closed by NVM_SessionEnd
+	uint8_t unlocked;							//1 while the session keeps PECR and FLASH unlocked
+} NVM_Session_TypeDef;
+
+typedef struct {
+	uint8_t op_type;							//NVM_OP_ERASE_PAGE, NVM_OP_WORD or NVM_OP_HALF_PAGE
+	uint32_t flash_addr;						//target address
+	uint32_t value;								//word to write for NVM_OP_WORD
+	uint32_t* src_ptr;							//16 word RAM source for NVM_OP_HALF_PAGE
+} NVM_AsyncOp_TypeDef;
+
+typedef struct {
+	NVM_AsyncOp_TypeDef queue[NVM_ASYNC_QUEUE_LEN];
+	uint8_t head;								//operation being executed
+	uint8_t tail;								//next free position
+	uint8_t count;								//operations still in the queue
+	volatile uint8_t busy;						//1 while the queue is being executed
+	void (*callback)(uint8_t status);			//called at the end of the queue
+} NVM_Async_TypeDef;
+
+typedef struct {
+	uint32_t last_cycles;						//length of the last IRQ-masked window, in core clock cycles
+	uint32_t worst_cycles;						//longest IRQ-masked window since the last NVM_IrqWindowReset
+	uint32_t window_cnt;						//number of windows measured
+} NVM_IrqWindow_TypeDef;
+
+typedef struct {
+	uint32_t magic;								//NVM_TELEM_MAGIC
+	uint32_t erase_total;						//page erases over the life of the part
+	uint16_t page_hist[NVM_TELEM_PAGE_CNT];		//erases of each page of the NVM data area
+	uint16_t bucket_hist[NVM_TELEM_BUCKET_CNT];	//erases per bucket of the rest of the FLASH
+} NVM_TelemetryLog_TypeDef;						//fills exactly one page
+
+typedef struct {
+	uint32_t erase_cnt;							//page erases since reset
+	uint32_t word_cnt;							//word writes since reset
+	uint32_t half_page_cnt;						//half page bursts since reset
+	uint32_t busy_cycles;						//cycles spent polling BSY/EOP since reset
+	uint32_t worst_busy_cycles;					//longest single BSY/EOP poll
+	uint16_t unsaved_cnt;						//erases since the log was last saved
+	volatile uint8_t save_pending;				//1 if NVM_TelemetryPoll should save the log
+	NVM_TelemetryLog_TypeDef log;				//erase log, saved in the NVM_TELEM page
+} NVM_Telemetry_TypeDef;
+
+typedef struct {
+	uint8_t status;								//last NVM_ERR_ code
+	volatile uint8_t irq_pending;				//1 if the FLASH IRQ has caught an error for the ongoing operation
+	uint32_t flash_sr;							//FLASH->SR when the error was found
+	uint32_t error_cnt;							//errors since reset
+} NVM_Error_TypeDef;
+
+typedef struct {
+	uint8_t max_retries;						//retries of a transient failure, 0 means no retry
+	uint16_t backoff_ms;						//wait before the first retry, doubled every time
+	uint32_t retry_cnt;							//retries done since reset
+} NVM_RetryPolicy_TypeDef;
+
+typedef struct {
+	uint8_t sleep_on_busy;						//1 if the blocking primitives sleep while the FLASH is busy
+	volatile uint8_t op_done;					//set by the FLASH IRQ when it has cleared EOP of a blocking operation
+	uint8_t deferred;							//1 if the asynchronous queue waits for the idle window
+	uint16_t idle_window_ms;					//idle time needed before the deferred queue is launched
+	uint32_t idle_tick;							//HAL tick of the last NVM_IdleKick
+	uint32_t sleep_cnt;							//WFIs done while the FLASH was busy
+	void (*deferred_callback)(uint8_t status);	//callback of the deferred queue
+} NVM_LowPower_TypeDef;
+
+typedef struct {
+	const uint32_t* base;						//first word of the region, read in place
+	uint32_t word_cnt;							//length of the region in words
+} NVM_View_TypeDef;
+
+#define NVM_VIEW_WORD(view, i)		((view)->base[(i)])		//word "i" of a read view, no range check
 
 //EXTERNAL VARIABLE
-extern uint32_t Data_buf [16];
+extern uint32_t Data_buf [NVM_CFG_HALF_PAGE_WORDS];
+extern NVM_Session_TypeDef NVM_session;
+extern NVM_Async_TypeDef NVM_async;
+extern NVM_IrqWindow_TypeDef NVM_irq_window;
+extern NVM_Telemetry_TypeDef NVM_telemetry;
+extern NVM_Error_TypeDef NVM_last_error;
+extern NVM_RetryPolicy_TypeDef NVM_retry;
+extern NVM_LowPower_TypeDef NVM_lowpower;
+extern uint32_t NVM_eeprom_next;
+extern uint32_t __nvm_telem_start__;
+extern uint32_t __nvm_code_start__;
+extern uint32_t __nvm_code_end__;
+extern uint32_t __nvm_app_start__;
+extern uint32_t __nvm_app_end__;
 
 //FUNCTION PROTOTYPES
 void NVM_Init (void);
-void FLASHErase_Page(uint32_t flash_page_addr);
-void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value);
+uint8_t FLASHErase_Page(uint32_t flash_page_addr);
+uint8_t FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value);
+uint8_t FLASHUpd_WordOrder(uint32_t flash_word_addr, uint32_t updated_flash_value, uint8_t byte_order);
 void FLASHIRQPriorEnable(void);
+void NVM_SessionBegin(void);
+void NVM_SessionEnd(void);
+uint8_t NVM_AsyncQueue(uint8_t op_type, uint32_t flash_addr, uint32_t value, uint32_t* src_ptr);
+uint8_t NVM_AsyncStart(void (*callback)(uint8_t status));
+uint8_t NVM_AsyncBusy(void);
+uint8_t FLASHPage_IsBlank(uint32_t flash_page_addr);
+uint32_t FLASHErase_Range(uint32_t flash_start_addr, uint32_t length);
+uint8_t FLASHUpd_Delta(uint32_t* src_ptr, uint32_t flash_addr, uint32_t word_cnt);
+void NVM_IrqWindowReset(void);
+void NVM_TelemetryInit(void);
+void NVM_TelemetrySave(void);
+uint16_t NVM_TelemetryPageErases(uint32_t flash_addr);
+void NVM_TelemetryDump(void);
+void NVM_TelemetryPoll(void);
+void NVM_SetRetryPolicy(uint8_t max_retries, uint16_t backoff_ms);
+uint32_t FLASHRegion_CRC(uint32_t flash_addr, uint32_t word_cnt);
+uint8_t FLASHVerify(uint32_t flash_addr, const uint32_t* src_ptr, uint32_t word_cnt);
+uint8_t EEPROMUpd_Byte(uint32_t eeprom_addr, uint8_t value);
+uint8_t EEPROMUpd_HalfWord(uint32_t eeprom_addr, uint16_t value);
+uint8_t EEPROMUpd_Word(uint32_t eeprom_addr, uint32_t value);
+uint8_t NVM_Write(uint32_t nvm_addr, const uint8_t* src_ptr, uint32_t byte_cnt);
+uint8_t NVM_BackendOf(uint32_t nvm_addr);
+uint8_t NVM_Route(uint32_t record_bytes, uint32_t updates_per_day);
+uint32_t NVM_RecordPlace(uint32_t record_bytes, uint32_t updates_per_day, uint32_t flash_addr);
+uint8_t NVM_ConfigCheck(void);
+uint8_t NVM_BankOf(uint32_t flash_addr);
+uint8_t NVM_RwwPossible(uint32_t flash_addr, uint32_t byte_cnt);
+uint8_t FLASHUpd_HalfPageRWW(const uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt);
+uint8_t FLASHUpd_HalfPageRWWOrder(const uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order);
+uint8_t FLASHUpd_HalfPageStreamBank(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt);
+uint8_t FLASHUpd_HalfPageStreamBankOrder(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order);
+void NVM_SetLowPower(uint8_t sleep_on_busy, uint16_t idle_window_ms);
+void NVM_IdleKick(void);
+uint8_t NVM_AsyncStartDeferred(void (*callback)(uint8_t status));
+void NVM_IdlePoll(void);
+uint8_t NVM_ViewOpen(NVM_View_TypeDef* view, uint32_t nvm_addr, uint32_t word_cnt);
+uint32_t NVM_WordCompare(const uint32_t* a_ptr, const uint32_t* b_ptr, uint32_t word_cnt);
+uint32_t NVM_WordScan(const uint32_t* ptr, uint32_t word_cnt, uint32_t value);
+uint8_t FLASHRegion_IsBlank(uint32_t flash_addr, uint32_t word_cnt);
 
-__attribute__((section(".RamFunc"))) void FLASHUpd_HalfPage(uint32_t flash_page_addr);
+__attribute__((section(".RamFunc"))) uint8_t FLASHUpd_HalfPage(uint32_t flash_page_addr);
+					//Note: this function MUST run from RAM, not FLASH!
+__attribute__((section(".RamFunc"))) uint8_t FLASHUpd_HalfPageStream(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt);
+					//Note: this function MUST run from RAM, not FLASH! The source buffer must be in RAM too.
+__attribute__((section(".RamFunc"))) uint8_t FLASHUpd_HalfPageStreamOrder(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint32_t word_cnt, uint8_t byte_order);
+					//Note: this function MUST run from RAM, not FLASH! The source buffer must be in RAM too.
+__attribute__((section(".RamFunc"))) void NVM_AsyncLaunch(NVM_AsyncOp_TypeDef* op);
 					//Note: this function MUST run from RAM, not FLASH!
+__attribute__((section(".RamFunc"))) uint8_t FLASHUpd_HalfPageDMA(uint32_t* src_ptr, uint32_t flash_half_page_addr, uint8_t prio_threshold);
+					//Note: this function MUST run from RAM, not FLASH! The source buffer must be in RAM too.
+__attribute__((section(".RamFunc"))) uint32_t NVM_GetCycles(void);
+					//Note: placed in RAM so the RAM functions can use it
 
 #endif /* INC_NVMDRIVER_STM32L0x3_CUSTOM_H_ */
 
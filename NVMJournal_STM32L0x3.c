@@ -0,0 +1,237 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.2
+ *  File: NVMJournal_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a write-ahead journal for page rewrites.
+ * Erasing a page and programming it again is not atomic: if the power drops in between, the page is left erased (or half written) and the code in it faults at the next call.
+ * A journaled rewrite goes through two reserved pages, NVM_JOURNAL (the entries) and NVM_STAGING (the new page content):
+ * - the new content is written into the staging page,
+ * - an entry with the target address and the CRC of the staging page is recorded,
+ * - the target is erased and programmed, and checked against the staging page,
+ * - the entry is closed with a DONE mark.
+ * The target is only ever erased after its entry holds a valid CRC, so at boot NVMJournal_Recover can tell the two cases apart with one scan of the 8 entries:
+ * - no valid CRC: the target has not been touched, the entry is closed with an ABORT mark (roll back),
+ * - valid CRC: the staging page is written into the target again (roll forward).
+ * Either way, the recovery is at most one page erase and one page write, a handful of milliseconds.
+ * The journal page itself is only erased once all its entries are closed, so an entry is never lost while it is open.
+ *
+ * v.1.1
+ * A full journal is only erased by NVMJournal_Recover and only if none of its entries stayed open. NVMJournal_PageWrite returns NVM_ERR_BUSY instead of erasing it over an open entry.
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.2
+ * NVMJournal_PageWrite runs the recovery whenever an entry is open, not only when the journal is full. A rewrite that failed after erasing its target no longer gets its staging page overwritten by the next rewrite, which the recovery would have rolled back and left the target erased.
+ *
+ */
+
+#include "NVMJournal_STM32L0x3.h"
+
+//RAM copy of the page being rewritten
+uint32_t JRNL_page_buf [JRNL_PAGE_WORDS];
+
+
+//0)Local helpers
+static NVMJournal_Entry_TypeDef* JRNL_Entry(uint8_t entry) {
+	return (NVMJournal_Entry_TypeDef*)((uint32_t)&__nvm_journal_start__ + ((uint32_t)entry * (JRNL_ENTRY_WORDS * 4)));
+}
+
+static uint8_t JRNL_FreeEntry(void) {
+	/**
+	 * Returns the first free entry, JRNL_ENTRY_CNT if there is none.
+	 **/
+
+	uint8_t entry = 0;
+
+	while((entry < JRNL_ENTRY_CNT) && (JRNL_Entry(entry)->target_addr != 0)) entry++;
+	return entry;
+}
+
+static uint8_t JRNL_OpenEntry(void) {
+	/**
+	 * Returns 1 if an entry is still open, i.e. a rewrite that was started but neither finished nor dropped.
+	 **/
+
+	for(uint8_t entry = 0; entry < JRNL_ENTRY_CNT; entry++) {
+		if((JRNL_Entry(entry)->target_addr != 0) && (JRNL_Entry(entry)->end_mark == 0)) return 1;
+	}
+	return 0;
+}
+
+static uint32_t JRNL_StagingCRC(void) {
+	/**
+	 * An entry with a CRC of 0 is one where the staging was not finished, so a real CRC of 0 is recorded as 1.
+	 **/
+
+	uint32_t crc_value = FLASHRegion_CRC((uint32_t)&__nvm_staging_start__, JRNL_PAGE_WORDS);
+	return (crc_value == 0) ? 1 : crc_value;
+}
+
+static uint8_t JRNL_TargetValid(uint32_t flash_page_addr) {
+	if((flash_page_addr & NVM_CFG_PAGE_MASK) != 0) return 0;			//must be a page
+	if(NVM_BackendOf(flash_page_addr) != NVM_BACKEND_FLASH) return 0;
+	if(flash_page_addr == (uint32_t)&__nvm_journal_start__) return 0;
+	if(flash_page_addr == (uint32_t)&__nvm_staging_start__) return 0;	//the journal can't protect its own pages
+	return 1;
+}
+
+static uint8_t JRNL_WriteMark(uint32_t* mark_ptr, uint32_t value) {
+	return FLASHUpd_WordOrder((uint32_t)mark_ptr, value, NVM_BYTE_ORDER_NATIVE);
+												//the entries are always in native order
+}
+
+static uint8_t JRNL_WritePage(uint32_t flash_page_addr) {
+	/**
+	 * Erases a page and writes JRNL_page_buf into it.
+	 **/
+
+	uint8_t status = FLASHErase_Page(flash_page_addr);
+	if(status == NVM_OK) status = FLASHUpd_HalfPageStreamOrder(JRNL_page_buf, flash_page_addr, JRNL_PAGE_WORDS, NVM_BYTE_ORDER_NATIVE);
+	if(status == NVM_OK) status = FLASHVerify(flash_page_addr, JRNL_page_buf, JRNL_PAGE_WORDS);
+	return status;
+}
+
+static uint8_t JRNL_Commit(NVMJournal_Entry_TypeDef* entry_ptr) {
+	/**
+	 * Writes JRNL_page_buf (the staged content) into the target of the entry and closes the entry.
+	 * If the target already holds the staged content (the power dropped after the write, before the DONE mark), only the mark is written.
+	 **/
+
+	uint8_t status = NVM_OK;
+
+	if(FLASHVerify(entry_ptr->target_addr, JRNL_page_buf, JRNL_PAGE_WORDS) != NVM_OK) {
+		status = JRNL_WritePage(entry_ptr->target_addr);
+	}
+	if(status == NVM_OK) status = JRNL_WriteMark(&entry_ptr->end_mark, JRNL_MARK_DONE);
+												//Note: an entry that fails stays open, the next NVMJournal_Recover tries again
+	return status;
+}
+
+
+//1)Journaled page rewrite
+uint8_t NVMJournal_PageWrite(uint32_t flash_page_addr, const uint32_t* src_ptr, uint32_t word_cnt) {
+	/**
+	 * Replaces the first "word_cnt" words of a FLASH page with "src_ptr", keeping the rest of the page, in a way that survives a power loss at any point.
+	 * If the page already holds the new content, nothing is written.
+	 *
+	 * 1)Build the new page in RAM
+	 * 2)Find a free entry, let the recovery first finish any open entry and erase the journal page if it is full
+	 * 3)Stage the new page
+	 * 4)Record the intent
+	 * 5)Rewrite the target and close the entry
+	 *
+	 * Returns NVM_OK or an NVM_ERR_ code. NVM_ERR_RANGE if the page can't be journaled, NVM_ERR_BUSY if an open entry can't be finished (or the journal stays full).
+	 *
+	 * Note: each rewrite costs two page erases (staging and target) and one word write more than a plain rewrite. The journal page is erased every 8 rewrites.
+	 * Note: an open entry is one whose rewrite failed after its target may have been erased. Its staging page is the only copy of the target, so it is never overwritten before that entry is closed.
+	 **/
+
+	uint8_t status = NVM_OK;
+	uint8_t entry = 0;
+	NVMJournal_Entry_TypeDef* entry_ptr;
+
+	//1)
+	if((JRNL_TargetValid(flash_page_addr) == 0) || (word_cnt > JRNL_PAGE_WORDS)) return NVM_ERR_RANGE;
+
+	for(uint8_t i = 0; i < JRNL_PAGE_WORDS; i++) {
+		JRNL_page_buf[i] = (i < word_cnt) ? src_ptr[i] : *(__IO uint32_t*)(flash_page_addr + (i * 4));
+	}
+
+	if(FLASHVerify(flash_page_addr, JRNL_page_buf, JRNL_PAGE_WORDS) == NVM_OK) return NVM_OK;
+
+	NVM_SessionBegin();
+
+	//2)
+	entry = JRNL_FreeEntry();
+
+	if((entry == JRNL_ENTRY_CNT) || (JRNL_OpenEntry() == 1)) {
+		NVMJournal_Recover();					//finishes any entry left open by a failed rewrite and erases the journal page if they are all closed
+		entry = JRNL_FreeEntry();
+		if((entry == JRNL_ENTRY_CNT) || (JRNL_OpenEntry() == 1)) {
+			NVM_SessionEnd();
+			return NVM_ERR_BUSY;
+		}										//an entry is still open: its staging page must not be overwritten
+		for(uint8_t i = 0; i < JRNL_PAGE_WORDS; i++) {
+			JRNL_page_buf[i] = (i < word_cnt) ? src_ptr[i] : *(__IO uint32_t*)(flash_page_addr + (i * 4));
+		}										//the recovery reuses JRNL_page_buf
+	}
+	entry_ptr = JRNL_Entry(entry);
+
+	//3)
+	if(status == NVM_OK) status = JRNL_WritePage((uint32_t)&__nvm_staging_start__);
+
+	//4)
+	if(status == NVM_OK) status = JRNL_WriteMark(&entry_ptr->target_addr, flash_page_addr);
+	if(status == NVM_OK) status = JRNL_WriteMark(&entry_ptr->staged_crc, JRNL_StagingCRC());
+												//Note: from here on, the recovery will finish the rewrite
+
+	//5)
+	if(status == NVM_OK) status = JRNL_Commit(entry_ptr);
+
+	NVM_SessionEnd();
+
+	return status;
+}
+
+
+//2)Finish or roll back an interrupted rewrite
+uint8_t NVMJournal_Recover(void) {
+	/**
+	 * Must be called at boot, before anything runs from a page that may be journaled.
+	 * One pass over the 8 entries. For every entry that is still open:
+	 * - if its CRC is missing or doesn't match the staging page, the staging (or the CRC mark) was cut before the target was erased: the entry is closed with ABORT,
+	 * - otherwise, the staging page is copied into RAM (the half page writer can't take its source from the FLASH) and written into the target.
+	 * If all the entries are closed and none is free, the journal page is erased here, so the next rewrite doesn't have to.
+	 * The page is kept if any entry stays open (its mark or its commit failed).
+	 *
+	 * Note: the CRC is only written once the staging page is complete, and the target is only erased after that. A mismatch on its own would not prove that the target is untouched, it does so here because
+	 * NVMJournal_PageWrite never stages a new page while an entry is open, so the staging page of an open entry with a written CRC is always the one it recorded.
+	 *
+	 * Returns the JRNL_RECOVER_ result of the last open entry found, JRNL_RECOVER_NONE if there was none.
+	 **/
+
+	uint8_t result = JRNL_RECOVER_NONE;
+	uint8_t free_cnt = 0;
+	uint8_t open_cnt = 0;
+	NVMJournal_Entry_TypeDef* entry_ptr;
+
+	NVM_SessionBegin();
+
+	for(uint8_t entry = 0; entry < JRNL_ENTRY_CNT; entry++) {
+		entry_ptr = JRNL_Entry(entry);
+
+		if(entry_ptr->target_addr == 0) {
+			free_cnt++;
+			continue;
+		}
+		if(entry_ptr->end_mark != 0) continue;	//closed
+
+		if((JRNL_TargetValid(entry_ptr->target_addr) == 0) || (entry_ptr->staged_crc == 0) || (entry_ptr->staged_crc != JRNL_StagingCRC())) {
+			if(JRNL_WriteMark(&entry_ptr->end_mark, JRNL_MARK_ABORT) != NVM_OK) open_cnt++;
+			result = JRNL_RECOVER_ROLLBACK;
+		} else {
+			for(uint8_t i = 0; i < JRNL_PAGE_WORDS; i++) {
+				JRNL_page_buf[i] = *(__IO uint32_t*)((uint32_t)&__nvm_staging_start__ + (i * 4));
+			}
+			if(JRNL_Commit(entry_ptr) == NVM_OK) {
+				result = JRNL_RECOVER_FORWARD;
+			} else {
+				result = JRNL_RECOVER_FAILED;
+				open_cnt++;
+			}
+		}
+	}
+
+	if((free_cnt == 0) && (open_cnt == 0)) {
+		FLASHErase_Page((uint32_t)&__nvm_journal_start__);
+	}
+
+	NVM_SessionEnd();
+
+	return result;
+}
@@ -0,0 +1,54 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.1
+ *  File: NVMJournal_STM32L0x3.h
+ *
+ *      This is a write-ahead journal for page rewrites in the FLASH.
+ *      The new page content is staged in a reserved page and the intent is recorded before the target is erased, so a rewrite cut by a power loss is finished at the next boot.
+ */
+
+#ifndef INC_NVMJOURNAL_STM32L0x3_H_
+#define INC_NVMJOURNAL_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define JRNL_PAGE_WORDS				NVM_CFG_PAGE_WORDS	//words in a page of FLASH
+#define JRNL_ENTRY_WORDS			4			//target address, CRC of the staged page, end marker, spare
+#define JRNL_ENTRY_CNT				8			//entries in the journal page, the page is erased once they are all used
+
+#define JRNL_MARK_DONE				0x444F4E45	//"DONE", the target holds the staged page
+#define JRNL_MARK_ABORT				0x41425254	//"ABRT", the target was never touched, nothing to finish
+
+#define JRNL_RECOVER_NONE			0			//the journal had nothing open
+#define JRNL_RECOVER_ROLLBACK		1			//an operation was dropped before its target was erased
+#define JRNL_RECOVER_FORWARD		2			//an operation was finished from the staging page
+#define JRNL_RECOVER_FAILED			3			//the staging page could not be written back
+
+//LOCAL VARIABLE
+typedef struct {
+	uint32_t target_addr;						//page being rewritten, 0 while the entry is free
+	uint32_t staged_crc;						//CRC of the staging page, 0 if the staging was not finished
+	uint32_t end_mark;							//JRNL_MARK_DONE or JRNL_MARK_ABORT, 0 while the operation is open
+	uint32_t spare;
+} NVMJournal_Entry_TypeDef;
+
+_Static_assert(sizeof(NVMJournal_Entry_TypeDef) == (JRNL_ENTRY_WORDS * 4), "journal entry size mismatch");
+_Static_assert((JRNL_ENTRY_CNT * JRNL_ENTRY_WORDS) == JRNL_PAGE_WORDS, "journal entries must fill exactly one page");
+
+//EXTERNAL VARIABLE
+extern uint32_t JRNL_page_buf [JRNL_PAGE_WORDS];
+extern uint32_t __nvm_journal_start__;
+extern uint32_t __nvm_staging_start__;
+
+//FUNCTION PROTOTYPES
+uint8_t NVMJournal_PageWrite(uint32_t flash_page_addr, const uint32_t* src_ptr, uint32_t word_cnt);
+uint8_t NVMJournal_Recover(void);
+
+#endif /* INC_NVMJOURNAL_STM32L0x3_H_ */
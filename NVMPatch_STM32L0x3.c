@@ -0,0 +1,332 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.6
+ *  File: NVMPatch_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a patcher for the constants in the .app_section.
+ * Instead of copying a hand-made machine code image into Data_buf, we look up the constant by name in the .patch_table the linker made for us, encode the new value and only change the halfwords of that encoding.
+ * Since the table is generated at build time, the addresses follow the code whenever it is rebuilt.
+ *
+ * v.1.1
+ * Added versioned constants.
+ * On L0xx, an erased word is 0 and can be written without erasing the page first. A versioned constant is an array of slots in a page of its own: the current value is the last non-zero slot and a new value is written into the next blank slot.
+ * This way a change is one word write (~3.2 ms) and the page is only erased when all the slots are used up.
+ *
+ * v.1.2
+ * The page geometry comes from NVMConfig.
+ *
+ * v.1.3
+ * Added NVMPatch_ImageReplace, which finds the "movs; lsls" constants in a RAM copy of the code by their encoding, so an image can be patched before it is written into the other slot.
+ *
+ * v.1.4
+ * NVMPatch_Write returns 0 if the delta update of a page fails.
+ *
+ * v.1.5
+ * NVMVConst_Write returns 0 if the erase or the write of the slot fails, instead of always reporting success.
+ *
+ * v.1.6
+ * A versioned constant takes two pages, each with a generation word. A full page is only renewed into the other one, so the constant reads its previous value while a page is erased instead of a blank one. The A/B selector therefore never reads as slot A by mistake during its renewal.
+ *
+ */
+
+#include "NVMPatch_STM32L0x3.h"
+#include "string.h"
+
+//halfwords to be changed by one NVMPatch_Write
+static uint32_t patch_hw_addr [PATCH_MAX_HALFWORDS];
+static uint16_t patch_hw_value [PATCH_MAX_HALFWORDS];
+
+
+//0)Local helpers
+static uint8_t PATCH_EncodeImm(uint32_t value, uint16_t* movs, uint16_t* lsls) {
+	/**
+	 * Re-encodes a "MOVS Rd, #imm8" / "LSLS Rd, Rm, #imm5" pair for a new value. The registers of the original pair are kept.
+	 * Returns 0 if the value can't be put into an imm8 << imm5 form.
+	 **/
+
+	uint8_t shift = 0;
+
+	while(((value >> shift) > 0xFF) || (((value >> shift) << shift) != value)) {
+		shift++;
+		if(shift > 24) return 0;
+	}
+
+	*movs = 0x2000 | (*movs & 0x0700) | (uint16_t)(value >> shift);
+	*lsls = (uint16_t)(shift << 6) | (*lsls & 0x3F);
+
+	return 1;
+}
+
+
+//1)Find a patch site
+const NVMPatch_Site_TypeDef* NVMPatch_Find(const char* name) {
+	/**
+	 * Returns the first descriptor in the .patch_table with the given name, or 0 if there is none.
+	 **/
+
+	for(const NVMPatch_Site_TypeDef* site = __patch_table_start__; site < __patch_table_end__; site++) {
+		if(strcmp(site->name, name) == 0) return site;
+	}
+
+	return 0;
+}
+
+
+//2)Read the current value of a patchable constant
+uint8_t NVMPatch_Read(const char* name, uint32_t* value) {
+	/**
+	 * Decodes the value of the constant directly from the FLASH. Returns 1 on success, 0 if the name is unknown or the encoding in the FLASH is not what we expect.
+	 *
+	 * Note: bit 0 of the site address is masked since code labels may come with the Thumb bit set.
+	 **/
+
+	const NVMPatch_Site_TypeDef* site = NVMPatch_Find(name);
+	if(site == 0) return 0;
+
+	uint32_t site_addr = site->site_addr & ~(uint32_t)1;
+
+	if(site->encoding == PATCH_ENC_THUMB_MOVS_LSLS) {
+		uint16_t movs = *(uint16_t*)(site_addr);
+		uint16_t lsls = *(uint16_t*)(site_addr + 2);
+		if(((movs & 0xF800) != 0x2000) || ((lsls & 0xF800) != 0x0000)) return 0;
+		*value = (uint32_t)(movs & 0xFF) << ((lsls >> 6) & 0x1F);
+		return 1;
+	} else if(site->encoding == PATCH_ENC_WORD) {
+		*value = *(uint32_t*)(site_addr);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+//3)Change the value of a patchable constant
+uint8_t NVMPatch_Write(const char* name, uint32_t value) {
+	/**
+	 * This function writes a new value into every site that has the given name.
+	 *
+	 * 1)We encode the value for every site and collect the halfwords to change.
+	 * 2)We go through the pages these halfwords are in. Each page is loaded into RAM, the halfwords are replaced and the page is handed to FLASHUpd_Delta.
+	 * 	 FLASHUpd_Delta then only erases/writes if the page actually changed.
+	 *
+	 * Returns 1 on success, 0 if the name is unknown, the value can't be encoded, a site is outside the .app_section, there are too many sites or a page write fails.
+	 *
+	 * Note: for PATCH_ENC_THUMB_MOVS_LSLS, the value must be an 8-bit number shifted left (e.g. 500 = 250 << 1 or 2000 = 250 << 3). The destination register of the original instructions is kept.
+	 * Note: we only patch inside the .app_section. Patching the rest of the FLASH - where this code is running from - is not allowed.
+	 **/
+
+	uint8_t hw_cnt = 0;
+	uint32_t page_buf [NVM_CFG_PAGE_WORDS];
+
+	//1)
+	for(const NVMPatch_Site_TypeDef* site = __patch_table_start__; site < __patch_table_end__; site++) {
+
+		if(strcmp(site->name, name) != 0) continue;
+
+		uint32_t site_addr = site->site_addr & ~(uint32_t)1;
+		if((site_addr < (uint32_t)&__app_section_start__) || ((site_addr + 4) > (uint32_t)&__app_section_end__)) return 0;
+		if((hw_cnt + 2) > PATCH_MAX_HALFWORDS) return 0;
+
+		if(site->encoding == PATCH_ENC_THUMB_MOVS_LSLS) {
+			uint16_t movs = *(uint16_t*)(site_addr);
+			uint16_t lsls = *(uint16_t*)(site_addr + 2);
+			if(PATCH_EncodeImm(value, &movs, &lsls) == 0) return 0;
+												//Note: we keep Rd of the MOVS and Rm and Rd of the original LSLS
+			patch_hw_addr[hw_cnt] = site_addr;
+			patch_hw_value[hw_cnt++] = movs;
+			patch_hw_addr[hw_cnt] = site_addr + 2;
+			patch_hw_value[hw_cnt++] = lsls;
+		} else if(site->encoding == PATCH_ENC_WORD) {
+			patch_hw_addr[hw_cnt] = site_addr;
+			patch_hw_value[hw_cnt++] = (uint16_t)(value & 0xFFFF);
+			patch_hw_addr[hw_cnt] = site_addr + 2;
+			patch_hw_value[hw_cnt++] = (uint16_t)(value >> 16);
+		} else {
+			return 0;
+		}
+	}
+
+	if(hw_cnt == 0) return 0;
+
+	//2)
+	for(uint8_t i = 0; i < hw_cnt; i++) {
+
+		uint32_t flash_page_addr = patch_hw_addr[i] & ~(uint32_t)NVM_CFG_PAGE_MASK;
+		uint8_t page_done = 0;
+
+		for(uint8_t j = 0; j < i; j++) {
+			if((patch_hw_addr[j] & ~(uint32_t)NVM_CFG_PAGE_MASK) == flash_page_addr) page_done = 1;
+		}
+		if(page_done == 1) continue;			//we have already written this page
+
+		memcpy(page_buf, (uint32_t*)flash_page_addr, NVM_CFG_PAGE_BYTES);
+
+		for(uint8_t j = i; j < hw_cnt; j++) {
+			if((patch_hw_addr[j] & ~(uint32_t)NVM_CFG_PAGE_MASK) == flash_page_addr) {
+				((uint16_t*)page_buf)[(patch_hw_addr[j] - flash_page_addr) / 2] = patch_hw_value[j];
+			}
+		}
+
+		if(FLASHUpd_Delta(page_buf, flash_page_addr, NVM_CFG_PAGE_WORDS) != NVM_OK) return 0;
+	}
+
+	return 1;
+}
+
+
+static uint8_t VCONST_FirstBlank(const __IO uint32_t* page_ptr) {
+	/**
+	 * Returns the first blank value slot of a page of a versioned constant, VCONST_PAGE_WORDS if they are all used.
+	 * The used slots always come first and the blank ones after them, so we can do a binary search instead of reading every slot.
+	 **/
+
+	uint8_t low = 1;							//word 0 is the generation
+	uint8_t high = VCONST_PAGE_WORDS;			//first slot known to be blank (or the end)
+
+	while(low < high) {
+		uint8_t mid = (low + high) / 2;
+		if(page_ptr[mid] != 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+static uint8_t VCONST_CurrentPage(const __IO uint32_t* slot_ptr) {
+	/**
+	 * Returns the page with the newer generation. A blank generation (0) is a page that was never used or is being renewed.
+	 **/
+
+	uint32_t gen_0 = slot_ptr[0];
+	uint32_t gen_1 = slot_ptr[VCONST_PAGE_WORDS];
+
+	if(gen_1 == 0) return 0;
+	if(gen_0 == 0) return 1;
+	return ((int32_t)(gen_1 - gen_0) > 0) ? 1 : 0;	//the generations only ever step by one, the difference survives a wrap-around
+}
+
+
+
+//4)Read a versioned constant
+uint32_t NVMVConst_Read(const uint32_t* slots) {
+	/**
+	 * Returns the value in the last non-zero slot of the current page, or 0 if all slots are blank.
+	 * If the current page has a generation but no value yet (the power was lost right after it was renewed), the last value of the other page is still the current one.
+	 *
+	 * Note: the slots are read as volatile, since the compiler sees a const array which it could otherwise fold to its default value.
+	 * Note: 0 is only returned for a constant that never held a value. The caller should then use its default.
+	 **/
+
+	const __IO uint32_t* slot_ptr = (const __IO uint32_t*)slots;
+	const __IO uint32_t* page_ptr;
+	uint8_t slot;
+	uint8_t page = VCONST_CurrentPage(slot_ptr);
+
+	for(uint8_t i = 0; i < VCONST_PAGE_CNT; i++) {
+		page_ptr = &slot_ptr[page * VCONST_PAGE_WORDS];
+		if(page_ptr[0] != 0) {
+			slot = VCONST_FirstBlank(page_ptr);
+			if(slot > 1) return page_ptr[slot - 1];
+		}
+		page ^= 1;								//no value in the current page yet, the other page still holds it
+	}
+
+	return 0;
+}
+
+
+//5)Change a versioned constant
+uint8_t NVMVConst_Write(const uint32_t* slots, uint32_t value) {
+	/**
+	 * Writes the new value into the next blank slot of the current page.
+	 * If the current page is full, the other page is erased, its generation is set one above the current page's and the value goes into its first slot.
+	 * The current page is left untouched until then, so a power loss during the renewal still reads the old value, and not a blank one.
+	 * If the value is already the current one, nothing is written.
+	 *
+	 * Returns 1 on success, 0 if the value is 0 (that is the blank state, it can't be stored), the slots are not in the APP_CONST area or the erase/write failed.
+	 *
+	 * 1)Check the inputs
+	 * 2)Find the next blank slot in the current page
+	 * 3)Renew the other page if there is no blank slot left
+	 * 4)Write the slot
+	 **/
+
+	const __IO uint32_t* slot_ptr = (const __IO uint32_t*)slots;
+	uint8_t page = 0;
+	uint8_t slot = 0;
+	uint32_t gen = 0;
+	uint8_t status = NVM_OK;
+
+	//1)
+	if(value == 0) return 0;
+	if(((uint32_t)slots < (uint32_t)&__app_const_start__) || (((uint32_t)slots + (VCONST_SLOT_CNT * 4)) > (uint32_t)&__app_const_end__)) return 0;
+	if(NVMVConst_Read(slots) == value) return 1;
+
+	//2)
+	page = VCONST_CurrentPage(slot_ptr);
+	gen = slot_ptr[page * VCONST_PAGE_WORDS];
+	slot = VCONST_FirstBlank(&slot_ptr[page * VCONST_PAGE_WORDS]);
+
+	NVM_SessionBegin();
+
+	//3)
+	if((gen == 0) || (slot == VCONST_PAGE_WORDS)) {
+		page ^= 1;
+		if(++gen == 0) gen = 1;					//0 is the blank generation
+		status = FLASHErase_Page((uint32_t)&slots[page * VCONST_PAGE_WORDS]);
+		if(status == NVM_OK) status = FLASHUpd_Word((uint32_t)&slots[page * VCONST_PAGE_WORDS], gen);
+		slot = 1;
+	}											//Note: if both pages are blank, the generation starts at 1 in page 1
+
+	//4)
+	if(status == NVM_OK) status = FLASHUpd_Word((uint32_t)&slots[(page * VCONST_PAGE_WORDS) + slot], value);
+
+	NVM_SessionEnd();
+
+	return (status == NVM_OK) ? 1 : 0;
+}
+
+
+//6)Change a constant in a RAM copy of the code
+uint8_t NVMPatch_ImageReplace(uint32_t* image_ptr, uint32_t word_cnt, uint32_t old_value, uint32_t new_value) {
+	/**
+	 * Looks for every "MOVS Rd, #imm8" directly followed by "LSLS Rd, Rd, #imm5" (the PATCH_ENC_THUMB_MOVS_LSLS encoding) that loads "old_value" in the image and re-encodes it with "new_value".
+	 * This is for an image that is changed in RAM before it is written somewhere else (e.g. into the inactive app slot), so it works on the copy and not on the FLASH.
+	 * The sites are found from the code itself, so they don't depend on the layout of the function (dispatch table, patch table or plain calls).
+	 *
+	 * Returns the number of sites changed, 0 if there was none or "new_value" has no imm8 << imm5 form.
+	 *
+	 * Note: a constant the compiler put into a literal pool is not found. PATCH_CONST_IMM makes sure a constant is a "movs; lsls" pair.
+	 **/
+
+	uint16_t* hw_ptr = (uint16_t*)image_ptr;
+	uint32_t hw_cnt = word_cnt * 2;
+	uint8_t site_cnt = 0;
+
+	for(uint32_t i = 0; (i + 1) < hw_cnt; i++) {
+		uint16_t movs = hw_ptr[i];
+		uint16_t lsls = hw_ptr[i + 1];
+		uint16_t rd = (movs >> 8) & 0x7;
+
+		if((movs & 0xF800) != 0x2000) continue;								//MOVS Rd, #imm8
+		if(((lsls & 0xF800) != 0x0000) || (((lsls >> 6) & 0x1F) == 0)) continue;	//LSLS Rd, Rm, #imm5 (imm5 0 is a MOVS register)
+		if(((lsls & 0x7) != rd) || (((lsls >> 3) & 0x7) != rd)) continue;	//on the same register
+		if(((uint32_t)(movs & 0xFF) << ((lsls >> 6) & 0x1F)) != old_value) continue;
+
+		if(PATCH_EncodeImm(new_value, &movs, &lsls) == 0) return 0;
+		hw_ptr[i] = movs;
+		hw_ptr[i + 1] = lsls;
+		site_cnt++;
+		i++;															//the LSLS can't be the start of another pair
+	}
+
+	return site_cnt;
+}
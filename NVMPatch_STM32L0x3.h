@@ -0,0 +1,108 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.4
+ *  File: NVMPatch_STM32L0x3.h
+ *
+ *      This is a patcher for constants that are compiled into the functions of the .app_section.
+ *      The patchable constants are marked in the code using the PATCH_CONST_ macros below. The macros put a descriptor of the constant into the .patch_table section, which is collected by the linker.
+ *      It also holds the versioned constants: append-only slot arrays in the APP_CONST memory area, which can be changed with a single word write.
+ */
+
+#ifndef INC_NVMPATCH_STM32L0x3_H_
+#define INC_NVMPATCH_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define PATCH_ENC_THUMB_MOVS_LSLS	1			//"MOVS Rd, #imm8" followed by "LSLS Rd, Rd, #imm5", value is imm8 << imm5
+#define PATCH_ENC_WORD				2			//a 32-bit literal word
+
+#define PATCH_MAX_HALFWORDS			8			//number of halfwords one NVMPatch_Write call can change
+
+#define VCONST_PAGE_CNT				2			//pages of each versioned constant, one of them always holds a valid value
+#define VCONST_PAGE_WORDS			NVM_CFG_PAGE_WORDS	//a generation word, then the value slots
+#define VCONST_SLOT_CNT				(VCONST_PAGE_WORDS * VCONST_PAGE_CNT)	//words of each versioned constant
+
+/*
+ * Versioned constant definition. It takes two full pages in the APP_CONST area. The first page holds generation 1 and the default value in its first slot, the rest is erased.
+ * Usage: NVM_VCONST(blink_delay_slots, 500);
+ */
+#define NVM_VCONST(name, default_value)											\
+	__attribute__((section(".app_const"), aligned(NVM_CFG_PAGE_BYTES), used))	\
+	const uint32_t name [VCONST_SLOT_CNT] = {1, default_value}
+
+/*
+ * Patchable constant as a Thumb immediate. Value is imm8 << shift.
+ * The macro evaluates to the constant and also emits the descriptor of the instructions into the .patch_table.
+ * imm8 and shift must be plain numbers, name is used without quotes.
+ */
+#define PATCH_CONST_IMM(name, imm8, shift) ({									\
+	uint32_t patch_value;														\
+	__asm volatile (															\
+		"1:	movs %0, #" #imm8 "\n\t"											\
+		"	lsls %0, %0, #" #shift "\n\t"										\
+		"	.pushsection .rodata.patch_names, \"a\"\n\t"						\
+		"2:	.asciz \"" #name "\"\n\t"											\
+		"	.popsection\n\t"													\
+		"	.pushsection .patch_table, \"a\"\n\t"								\
+		"	.balign 4\n\t"														\
+		"	.word 2b\n\t"														\
+		"	.word 1b\n\t"														\
+		"	.word 1\n\t"														\
+		"	.popsection\n\t"													\
+		: "=l" (patch_value) : : "cc");										\
+	patch_value; })
+
+/*
+ * Patchable constant as a 32-bit literal word placed in the code itself. The code branches over the literal.
+ */
+#define PATCH_CONST_WORD(name, value) ({										\
+	uint32_t patch_value;														\
+	__asm volatile (															\
+		"	ldr %0, 1f\n\t"														\
+		"	b 3f\n\t"															\
+		"	.balign 4\n\t"														\
+		"1:	.word " #value "\n\t"												\
+		"3:\n\t"																\
+		"	.pushsection .rodata.patch_names, \"a\"\n\t"						\
+		"2:	.asciz \"" #name "\"\n\t"											\
+		"	.popsection\n\t"													\
+		"	.pushsection .patch_table, \"a\"\n\t"								\
+		"	.balign 4\n\t"														\
+		"	.word 2b\n\t"														\
+		"	.word 1b\n\t"														\
+		"	.word 2\n\t"														\
+		"	.popsection\n\t"													\
+		: "=l" (patch_value) : : "cc");										\
+	patch_value; })
+
+//LOCAL VARIABLE
+typedef struct {
+	const char* name;							//name of the constant, the same name can be used at multiple sites
+	uint32_t site_addr;							//address of the encoding in FLASH
+	uint32_t encoding;							//PATCH_ENC_THUMB_MOVS_LSLS or PATCH_ENC_WORD
+} NVMPatch_Site_TypeDef;
+
+//EXTERNAL VARIABLE
+extern const NVMPatch_Site_TypeDef __patch_table_start__[];
+extern const NVMPatch_Site_TypeDef __patch_table_end__[];
+extern uint32_t __app_section_start__;
+extern uint32_t __app_section_end__;
+extern uint32_t __app_const_start__;
+extern uint32_t __app_const_end__;
+
+//FUNCTION PROTOTYPES
+const NVMPatch_Site_TypeDef* NVMPatch_Find(const char* name);
+uint8_t NVMPatch_Read(const char* name, uint32_t* value);
+uint8_t NVMPatch_Write(const char* name, uint32_t value);
+uint32_t NVMVConst_Read(const uint32_t* slots);
+uint8_t NVMVConst_Write(const uint32_t* slots, uint32_t value);
+uint8_t NVMPatch_ImageReplace(uint32_t* image_ptr, uint32_t word_cnt, uint32_t old_value, uint32_t new_value);
+
+#endif /* INC_NVMPATCH_STM32L0x3_H_ */
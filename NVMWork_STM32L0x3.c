@@ -0,0 +1,98 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: NVMWork_STM32L0x3.c
+ *  Change history:
+ *
+ * v.1.0
+ * Below is a deferred work queue.
+ * An erase and a rewrite take several ms. Done within an IRQ, they block every IRQ of the same or lower priority for that long, and a bouncing button queues them back-to-back.
+ * Here, the IRQ only calls NVMWork_Post, which sets a bit and takes a timestamp - a few us. The main loop calls NVMWork_Run, which runs a request once it hasn't been posted for NVM_WORK_DEBOUNCE_MS.
+ * A request posted again while it is pending is not queued twice, it only restarts the debounce window. So all the bounces of one press end up as one run.
+ * All the requests that are due are run within one NVM session, so a batch goes through the unlock sequence once.
+ *
+ * Note: the work runs between two main loop iterations, so it never rewrites code that the main loop is executing at that moment.
+ *
+ */
+
+#include "NVMWork_STM32L0x3.h"
+#include "main.h"
+
+//Work queue state
+NVMWork_TypeDef NVM_work = {0};
+
+
+//1)Register the work of a request
+void NVMWork_Register(uint8_t work_id, void (*handler)(void)) {
+	if(work_id >= NVM_WORK_SLOTS) return;
+	NVM_work.handler[work_id] = handler;
+}
+
+
+//2)Post a request
+void NVMWork_Post(uint8_t work_id) {
+	/**
+	 * Can be called from any IRQ. Nothing is done here but the bookkeeping.
+	 **/
+
+	uint32_t primask;
+
+	if(work_id >= NVM_WORK_SLOTS) return;
+
+	primask = __get_PRIMASK();
+	__disable_irq();							//an IRQ of higher priority may post too
+	if((NVM_work.pending_mask & (1<<work_id)) != 0) NVM_work.coalesced_cnt++;
+	NVM_work.pending_mask |= (1<<work_id);
+	NVM_work.post_tick[work_id] = HAL_GetTick();
+	NVM_work.post_cnt++;
+	__set_PRIMASK(primask);
+}
+
+
+//3)Run the requests that have settled
+uint8_t NVMWork_Run(void) {
+	/**
+	 * To be called from the main loop.
+	 *
+	 * 1)Take the requests that are due out of the queue
+	 * 2)Run them within one NVM session
+	 *
+	 * Returns the number of requests run.
+	 **/
+
+	uint32_t due_mask = 0;
+	uint32_t primask;
+	uint8_t run_cnt = 0;
+
+	if(NVM_work.pending_mask == 0) return 0;
+
+	//1)
+	primask = __get_PRIMASK();
+	__disable_irq();
+	for(uint8_t i = 0; i < NVM_WORK_SLOTS; i++) {
+		if(((NVM_work.pending_mask & (1<<i)) != 0) && ((HAL_GetTick() - NVM_work.post_tick[i]) >= NVM_WORK_DEBOUNCE_MS)) {
+			due_mask |= (1<<i);
+		}
+	}
+	NVM_work.pending_mask &= ~due_mask;			//a post from now on is a new request
+	__set_PRIMASK(primask);
+
+	if(due_mask == 0) return 0;
+
+	//2)
+	NVM_SessionBegin();
+	for(uint8_t i = 0; i < NVM_WORK_SLOTS; i++) {
+		if(((due_mask & (1<<i)) != 0) && (NVM_work.handler[i] != 0)) {
+			NVM_work.handler[i]();
+			run_cnt++;
+		}
+	}
+	NVM_SessionEnd();
+
+	NVM_work.run_cnt += run_cnt;
+
+	return run_cnt;
+}
@@ -0,0 +1,45 @@
+/*
+ *  Created on: Oct 14, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_NVMDriver
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: NVMWork_STM32L0x3.h
+ *
+ *      This is a deferred work queue for NVM updates.
+ *      IRQs only post a request, and the main loop runs it once the request has settled (debouncing). Repeated posts of the same request coalesce into one run.
+ */
+
+#ifndef INC_NVMWORK_STM32L0x3_H_
+#define INC_NVMWORK_STM32L0x3_H_
+
+#include "stdint.h"
+#include "stm32l053xx.h"
+
+#include "NVMDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define NVM_WORK_SLOTS				8			//different requests the queue can hold, one bit each
+#define NVM_WORK_DEBOUNCE_MS		50			//a request runs once it hasn't been posted again for this long
+
+#define NVM_WORK_BLINK_UPDATE		0			//EXTI13: rewrite the Blink_custom delays
+
+//LOCAL VARIABLE
+typedef struct {
+	volatile uint32_t pending_mask;				//requests posted and not yet run
+	volatile uint32_t post_tick [NVM_WORK_SLOTS];	//HAL tick of the last post of each request
+	void (*handler [NVM_WORK_SLOTS])(void);		//work of each request
+	uint32_t post_cnt;							//posts since reset
+	uint32_t coalesced_cnt;						//posts that landed on a request already pending, each one is an NVM update spared
+	uint32_t run_cnt;							//requests run since reset
+} NVMWork_TypeDef;
+
+//EXTERNAL VARIABLE
+extern NVMWork_TypeDef NVM_work;
+
+//FUNCTION PROTOTYPES
+void NVMWork_Register(uint8_t work_id, void (*handler)(void));
+void NVMWork_Post(uint8_t work_id);
+uint8_t NVMWork_Run(void);
+
+#endif /* INC_NVMWORK_STM32L0x3_H_ */
@@ -33,6 +33,14 @@
 
 #include "NVMDriver_STM32L0x3.h"
 #include "EXTIDriver_STM32L0x3.h"
+#include "NVMPatch_STM32L0x3.h"
+#include "KVStore_STM32L0x3.h"
+#include "APPSlot_STM32L0x3.h"
+#include "NVMBench_STM32L0x3.h"
+#include "ImageRX_STM32L0x3.h"
+#include "NVMJournal_STM32L0x3.h"
+#include "NVMCache_STM32L0x3.h"
+#include "NVMWork_STM32L0x3.h"
 
 /* USER CODE END Includes */
 
@@ -63,6 +71,9 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_USART2_UART_Init(void);
 /* USER CODE BEGIN PFP */
+#if defined(nvm_telemetry) && !defined(image_rx)
+static void Telemetry_Command(void);
+#endif
 
 /* USER CODE END PFP */
 
@@ -76,19 +87,31 @@ void Blink_PA5_init(void){
 }
 
 void Blink_custom(void) {						//this is placed in the APP_MEM memory section defined in the linker file
-												//APP_MEM is 16 kbytes and starts at 0x0800c000
+												//APP_MEM is 8 kbytes (slot A) and starts at 0x0800c000
 	GPIOA->BSRR |= (1<<5);
-	HAL_Delay(500);
+#ifdef patch_table
+	APP_DELAY(PATCH_CONST_IMM(blink_delay, 250, 1));		//500 ms as "movs; lsls", registered in the .patch_table as "blink_delay"
+#elif defined(versioned_const)
+	APP_DELAY(APP_VCONST_READ(blink_delay_slots));			//latest value of the versioned constant
+#else
+	APP_DELAY(500);							//through the app_api dispatch table if "app_dispatch" is defined
+#endif
 //	Delay_ms(200);							//even though we call the Blink with a delay of 2000 ms, we change this value in the FLASH below to 500 ms or 1000 ms
 	GPIOA->BRR |= (1<<5);
-	HAL_Delay(500);
+#ifdef patch_table
+	APP_DELAY(PATCH_CONST_IMM(blink_delay, 250, 1));
+#elif defined(versioned_const)
+	APP_DELAY(APP_VCONST_READ(blink_delay_slots));
+#else
+	APP_DELAY(500);
+#endif
 //	Delay_ms(200);
 }
 
 
 //this is the machine code we will be uploading into the mcu. It is already endian swapped.
 
-uint32_t Data_buf [16] = {
+uint32_t Data_buf [NVM_CFG_HALF_PAGE_WORDS] = {
 		  0xAF00B580,
 		  0x05DB23A0,
 		  0x23A0699A,
@@ -111,6 +134,9 @@ uint32_t Data_buf [16] = {
 uint32_t toggle_value1;
 uint32_t toggle_value2;
 
+//the Blink_custom delay as a versioned constant in the APP_CONST area, 500 ms by default
+NVM_VCONST(blink_delay_slots, 500);
+
 /* USER CODE END 0 */
 
 /**
@@ -145,6 +171,37 @@ int main(void)
   MX_GPIO_Init();
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
+#ifdef nvm_journal
+  NVMJournal_Recover();							//a page rewrite cut by a power loss is finished (or dropped) before Blink_custom is called
+#endif
+#ifdef ab_slots
+  NVM_Init();									//the background update needs the FLASH IRQ
+  FLASHIRQPriorEnable();
+  APP_BootCheck();								//if the active slot is broken and the other is fine, we switch
+#endif
+#ifdef kv_store
+  KV_Init();									//the RAM index of the key/value store is rebuilt from the FLASH
+#endif
+#ifdef nvm_telemetry
+  NVM_TelemetryInit();							//the saved erase log is loaded from the NVM_TELEM page
+#endif
+#ifdef image_rx
+  NVM_Init();									//error IRQ for the FLASH writes of the receiver
+  FLASHIRQPriorEnable();
+  ImageRXInit();								//images sent over USART2 are written into the FLASH
+#endif
+#ifdef nvm_work_queue
+  NVMWork_Register(NVM_WORK_BLINK_UPDATE, EXTI_BlinkUpdate);	//the button only posts, the update runs from the main loop
+#endif
+#ifdef nvm_low_power
+  NVM_Init();
+  FLASHIRQPriorEnable();						//EOP wakes the core up from the WFI of the primitives
+  NVM_SetLowPower(1, NVM_IDLE_WINDOW_MS);
+#endif
+#ifdef nvm_benchmark
+  NVMBench_Run();								//the benchmark replaces the main loop, we stop once the results are printed
+  while(1);
+#endif
 
   /* USER CODE END 2 */
 
@@ -153,7 +210,43 @@ int main(void)
   while (1)
   {
     /* USER CODE END WHILE */
+#if defined(app_in_ram)
+	  APP_RamRefresh();							//Blink_custom is copied into RAM at the first call and after every change
+	  APP_CallRAM(Blink_custom);
+#ifdef ab_slots
+	  APP_UpdateCommit();
+#endif
+#elif defined(ab_slots)
+	  APP_Call(Blink_custom);					//Blink_custom is called from whichever slot is active
+	  APP_UpdateCommit();						//if an update has been written in the background, we switch to it
+#else
 	  Blink_custom();
+#endif
+#ifdef image_rx
+	  if(ImageRX.state == IMGRX_DONE) {			//a complete image has been received
+#ifdef ab_slots
+		  if(APP_SlotValid(ImageRX.dst_base) == 1) APP_SwitchToSlot(ImageRX.dst_base);
+												//the receiver only accepts the inactive slot and has written its footer
+#endif
+		  APP_RamInvalidate();
+		  ImageRX_Restart();
+	  }
+#endif
+#ifdef nvm_work_queue
+	  NVMWork_Run();								//updates posted by the IRQs are run here, once debounced
+#endif
+#ifdef nvm_low_power
+	  NVM_IdlePoll();							//a deferred asynchronous queue is launched once we have been idle long enough
+#endif
+#ifdef nvm_cache
+	  NVMCache_Poll();							//cached FLASH writes are flushed NVM_CACHE_FLUSH_MS after their first change
+#endif
+#ifdef nvm_telemetry
+	  NVM_TelemetryPoll();						//the erase log is saved once it is due
+#ifndef image_rx
+	  Telemetry_Command();						//"t" over USART2 prints the NVM telemetry, "s" saves the erase log
+#endif											//with the image receiver, the RX of USART2 belongs to its DMA
+#endif
     /* USER CODE BEGIN 3 */
   }
   /* USER CODE END 3 */
@@ -280,6 +373,35 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
+//printf is sent over USART2
+int __io_putchar(int ch) {
+	uint8_t tx_byte = (uint8_t)ch;
+
+#ifdef image_rx
+	if(ImageRX.state == IMGRX_RECEIVING) return ch;	//USART2 belongs to the image receiver while an image comes in
+#endif
+	HAL_UART_Transmit(&huart2, &tx_byte, 1, HAL_MAX_DELAY);
+	return ch;
+}
+
+#if defined(nvm_telemetry) && !defined(image_rx)
+//single character commands over USART2, polled between two blinks
+static void Telemetry_Command(void) {
+	uint8_t rx_byte;
+
+	if(__HAL_UART_GET_FLAG(&huart2, UART_FLAG_RXNE) == 0) return;
+
+	HAL_UART_Receive(&huart2, &rx_byte, 1, 0);
+
+	if(rx_byte == 't') {
+		NVM_TelemetryDump();
+	} else if(rx_byte == 's') {
+		NVM_TelemetrySave();
+		printf("NVM telemetry saved\r\n");
+	}
+}
+#endif
+
 /* USER CODE END 4 */
 
 /**
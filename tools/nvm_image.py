@@ -0,0 +1,303 @@
+#!/usr/bin/env python3
+#
+#  Author: BalazsFarkas
+#  Project: STM32_NVMDriver
+#  Processor: STM32L053R8
+#  Program version: 1.1
+#  File: nvm_image.py
+#  Change history:
+#
+# v.1.0
+# Host side image builder for the app slots.
+# It takes the .app_section out of the ELF built by the STM32CubeIDE, moves its BLs to the target slot, and cuts it into half pages.
+# The output is ready to program as it is: the words are in the order the FLASH stores them, so the device needs no swapping (NVM_BYTE_ORDER_NATIVE) and no APP_RelocateBL.
+# The half pages can be written out as:
+# - a raw binary, padded to a half page with 0 (the erased state of the L0),
+# - a C initializer, to paste into Data_buf,
+# - an ImageRX frame stream (start, data, end frames, each with its CRC), to be sent over USART2 by this script or by any other tool.
+# The CRCs are the same as the CRC peripheral with its reset settings calculates (see CRCDriver_STM32L0x3.c), so the end frame CRC is the one APP_WriteFooter checks.
+#
+# Note: only the Python standard library is used. Sending over a serial port needs pyserial.
+#
+# v.1.1
+# The target must be page aligned, as ImageRX_DstValid requires, and the sizes are derived from the page size (NVM_CFG_PAGE_BYTES).
+#
+
+import argparse
+import struct
+import sys
+
+#LOCAL CONSTANT
+PAGE_BYTES = 128                #NVM_CFG_PAGE_BYTES
+HALF_PAGE_BYTES = PAGE_BYTES // 2   #NVM_CFG_HALF_PAGE_BYTES
+HALF_PAGE_WORDS = HALF_PAGE_BYTES // 4  #NVM_CFG_HALF_PAGE_WORDS
+APP_FOOTER_RESERVED = PAGE_BYTES    #the last page of each slot is for the footer (APP_FOOTER_RESERVED)
+
+IMGRX_SOF = 0x55
+IMGRX_TYPE_START = ord('S')
+IMGRX_TYPE_DATA = ord('D')
+IMGRX_TYPE_END = ord('E')
+IMGRX_ACK = 0x06
+IMGRX_NAK = 0x15
+IMGRX_WINDOW = 2                #frames the sender may have without an answer
+
+NVM_BYTE_ORDER_NATIVE = 0
+
+CRC_INITIAL_VALUE = 0xFFFFFFFF
+CRC_POLY = 0x04C11DB7
+
+SHT_SYMTAB = 2
+SHT_REL = 9
+R_ARM_THM_CALL = 10
+
+
+#0)CRC of the STM32 CRC peripheral
+def crc32_stm32(words, crc_value=CRC_INITIAL_VALUE):
+    """
+    32-bit polynomial 0x04C11DB7, no reversal, no final XOR, fed one 32-bit word at a time.
+    """
+    for word in words:
+        crc_value ^= word
+        for _ in range(32):
+            if crc_value & 0x80000000:
+                crc_value = ((crc_value << 1) ^ CRC_POLY) & 0xFFFFFFFF
+            else:
+                crc_value = (crc_value << 1) & 0xFFFFFFFF
+    return crc_value
+
+
+#1)ELF reading
+class Elf32:
+    """
+    The minimum of an ELF32 little endian reader: section headers, section data, symbols and REL relocations.
+    """
+
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 1:
+            raise ValueError("not an ELF32 little endian file")
+        self.data = data
+        e_shoff, = struct.unpack_from('<I', data, 0x20)
+        e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+        self.sections = []
+        for i in range(e_shnum):
+            fields = struct.unpack_from('<10I', data, e_shoff + (i * e_shentsize))
+            self.sections.append(dict(zip(('name', 'type', 'flags', 'addr', 'offset', 'size', 'link', 'info', 'addralign', 'entsize'), fields)))
+        strtab = self.sections[e_shstrndx]
+        for section in self.sections:
+            section['name_str'] = self._string(strtab, section['name'])
+
+    def _string(self, strtab, offset):
+        start = strtab['offset'] + offset
+        return self.data[start:self.data.index(b'\x00', start)].decode()
+
+    def section(self, name):
+        for section in self.sections:
+            if section['name_str'] == name:
+                return section
+        return None
+
+    def section_data(self, section):
+        return bytearray(self.data[section['offset']:section['offset'] + section['size']])
+
+    def symbols(self):
+        symbols = {}
+        for section in self.sections:
+            if section['type'] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[section['link']]
+            for i in range(section['size'] // 16):
+                st_name, st_value = struct.unpack_from('<II', self.data, section['offset'] + (i * 16))
+                if st_name != 0:
+                    symbols[self._string(strtab, st_name)] = st_value
+        return symbols
+
+    def call_relocations(self, target_section):
+        """
+        Addresses of the BLs in the section, if the ELF was linked with -Wl,--emit-relocs. None otherwise.
+        """
+        index = self.sections.index(target_section)
+        found = False
+        addresses = []
+        for section in self.sections:
+            if section['type'] != SHT_REL or section['info'] != index:
+                continue
+            found = True
+            for i in range(section['size'] // 8):
+                r_offset, r_info = struct.unpack_from('<II', self.data, section['offset'] + (i * 8))
+                if (r_info & 0xFF) == R_ARM_THM_CALL:
+                    addresses.append(r_offset)
+        return addresses if found else None
+
+
+#2)BL relocation, the same as APP_RelocateBL
+def bl_decode(hw1, hw2):
+    s = (hw1 >> 10) & 1
+    i1 = (~(((hw2 >> 13) & 1) ^ s)) & 1
+    i2 = (~(((hw2 >> 11) & 1) ^ s)) & 1
+    offset = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FF) << 1)
+    if s:
+        offset -= (1 << 25)                                 #sign extension from 25 bits
+    return offset
+
+
+def bl_encode(offset):
+    if not -(1 << 24) <= offset < (1 << 24):
+        raise ValueError("BL target out of range")
+    s = (offset >> 24) & 1
+    j1 = ((~(offset >> 23)) ^ s) & 1
+    j2 = ((~(offset >> 22)) ^ s) & 1
+    hw1 = 0xF000 | (s << 10) | ((offset >> 12) & 0x3FF)
+    hw2 = 0xD000 | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x7FF)
+    return hw1, hw2
+
+
+def relocate_bl(image, old_base, new_base, bl_addresses=None):
+    """
+    Every BL that calls outside the image is re-encoded for the new address. Calls within the image move with it.
+    With the relocations of the ELF, only the real BLs are touched. Without them, the image is scanned for BL patterns like the device does.
+    Returns the number of BLs changed.
+    """
+    if old_base == new_base:
+        return 0
+
+    image_end = old_base + len(image)
+    if bl_addresses is None:
+        candidates = range(0, len(image) - 3, 2)
+    else:
+        candidates = [addr - old_base for addr in bl_addresses if old_base <= addr < image_end]
+
+    changed = 0
+    skip_to = 0
+    for pos in candidates:
+        if pos < skip_to:
+            continue
+        hw1, hw2 = struct.unpack_from('<HH', image, pos)
+        if (hw1 & 0xF800) != 0xF000 or (hw2 & 0xD000) != 0xD000:
+            continue
+        skip_to = pos + 4
+        target = old_base + pos + 4 + bl_decode(hw1, hw2)
+        if old_base <= target < image_end:
+            continue
+        struct.pack_into('<HH', image, pos, *bl_encode(target - (new_base + pos + 4)))
+        changed += 1
+    return changed
+
+
+#3)Half pages and frames
+def half_page_words(image):
+    padded = bytes(image) + bytes((-len(image)) % HALF_PAGE_BYTES)
+    return list(struct.unpack('<%dI' % (len(padded) // 4), padded))
+
+
+def frame(frame_type, seq, payload_words):
+    payload_words = list(payload_words) + [0] * (HALF_PAGE_WORDS - len(payload_words))
+    header = struct.unpack('<I', bytes((IMGRX_SOF, frame_type, seq & 0xFF, seq >> 8)))[0]
+    words = [header] + payload_words
+    return struct.pack('<18I', *(words + [crc32_stm32(words)]))
+
+
+def build_frames(words, image_word_cnt, dst_addr):
+    chunk_cnt = len(words) // HALF_PAGE_WORDS
+    frames = [frame(IMGRX_TYPE_START, 0, [dst_addr, chunk_cnt, NVM_BYTE_ORDER_NATIVE])]
+    for chunk in range(chunk_cnt):
+        frames.append(frame(IMGRX_TYPE_DATA, chunk + 1, words[chunk * HALF_PAGE_WORDS:(chunk + 1) * HALF_PAGE_WORDS]))
+    frames.append(frame(IMGRX_TYPE_END, chunk_cnt + 1, [image_word_cnt, crc32_stm32(words[:image_word_cnt])]))
+    return frames
+
+
+def c_array(words, dst_addr):
+    lines = ["/* %d half page(s) for 0x%08X, FLASH word order (NVM_BYTE_ORDER_NATIVE) */" % (len(words) // HALF_PAGE_WORDS, dst_addr)]
+    for chunk in range(len(words) // HALF_PAGE_WORDS):
+        row = words[chunk * HALF_PAGE_WORDS:(chunk + 1) * HALF_PAGE_WORDS]
+        lines.append("{" + ", ".join("0x%08X" % w for w in row) + "},")
+    return "\n".join(lines) + "\n"
+
+
+#4)Sending over USART2
+def send(port_name, frames, baud=115200, retries=8):
+    """
+    Sliding window of IMGRX_WINDOW frames. Each reply is ACK/NAK and the sequence number the device expects next, the window restarts from there.
+    """
+    import serial
+
+    with serial.Serial(port_name, baud, timeout=1.0) as port:
+        next_seq = 0
+        failures = 0
+        while next_seq < len(frames):
+            window = range(next_seq, min(next_seq + IMGRX_WINDOW, len(frames)))
+            for seq in window:
+                port.write(frames[seq])
+            expected_seq = next_seq
+            for _ in window:
+                reply = port.read(3)
+                if len(reply) != 3 or reply[0] not in (IMGRX_ACK, IMGRX_NAK):
+                    break                                   #lost or garbled, the idle line resyncs the device
+                expected_seq = max(expected_seq, reply[1] | (reply[2] << 8))
+            if expected_seq == next_seq:
+                failures += 1
+                if failures > retries:
+                    raise IOError("frame %d refused" % next_seq)
+                port.reset_input_buffer()
+            else:
+                failures = 0
+            next_seq = expected_seq
+
+
+#5)Entry
+def main(argv=None):
+    parser = argparse.ArgumentParser(description="Build programmable half page images of the .app_section.")
+    parser.add_argument('elf', help="ELF built by the STM32CubeIDE")
+    parser.add_argument('--section', default='.app_section')
+    target = parser.add_mutually_exclusive_group()
+    target.add_argument('--slot', choices=('a', 'b'), default='a', help="target app slot (default: a, where the section is linked)")
+    target.add_argument('--dst', type=lambda v: int(v, 0), help="target address, must be page aligned (ImageRX_DstValid)")
+    parser.add_argument('--bin', help="write the padded image")
+    parser.add_argument('--c-array', help="write the half pages as a C initializer")
+    parser.add_argument('--frames', help="write the ImageRX frame stream")
+    parser.add_argument('--port', help="send the frames over this serial port")
+    args = parser.parse_args(argv)
+
+    with open(args.elf, 'rb') as elf_file:
+        elf = Elf32(elf_file.read())
+
+    section = elf.section(args.section)
+    if section is None:
+        sys.exit("no %s in %s" % (args.section, args.elf))
+    image = elf.section_data(section)
+    symbols = elf.symbols()
+
+    if args.dst is not None:
+        dst_addr = args.dst
+    else:
+        dst_addr = symbols.get('__app_slot_%s_start__' % args.slot, section['addr'])
+    if dst_addr % PAGE_BYTES:
+        sys.exit("target 0x%08X is not page aligned, the device would NAK it" % dst_addr)
+
+    slot_size = symbols.get('__app_slot_size__')
+    if slot_size is not None and len(image) > slot_size - APP_FOOTER_RESERVED:
+        sys.exit("image of %d bytes doesn't fit below the slot footer" % len(image))
+
+    bl_cnt = relocate_bl(image, section['addr'], dst_addr, elf.call_relocations(section))
+    words = half_page_words(image)
+    image_word_cnt = (len(image) + 3) // 4
+    frames = build_frames(words, image_word_cnt, dst_addr)
+
+    print("%s: %d bytes linked at 0x%08X, target 0x%08X, %d BL(s) moved" % (args.section, len(image), section['addr'], dst_addr, bl_cnt))
+    print("%d half page(s), %d word(s), image CRC 0x%08X" % (len(words) // HALF_PAGE_WORDS, image_word_cnt, crc32_stm32(words[:image_word_cnt])))
+
+    if args.bin:
+        with open(args.bin, 'wb') as out:
+            out.write(struct.pack('<%dI' % len(words), *words))
+    if args.c_array:
+        with open(args.c_array, 'w') as out:
+            out.write(c_array(words, dst_addr))
+    if args.frames:
+        with open(args.frames, 'wb') as out:
+            out.write(b''.join(frames))
+    if args.port:
+        send(args.port, frames)
+        print("sent")
+
+
+if __name__ == '__main__':
+    main()